@@ -0,0 +1,75 @@
+#include "AllocationTracker.hpp"
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+static std::atomic<uint64_t> num_allocations(0);
+static std::atomic<uint64_t> num_frees(0);
+static std::atomic<uint64_t> num_bytes(0);
+
+#ifdef TRACK_ALLOCATIONS
+bool tracking_allocations() {
+  return true;
+}
+
+static void *counted_malloc(size_t size) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  num_bytes.fetch_add(size, std::memory_order_relaxed);
+  return malloc(size == 0 ? 1 : size);
+}
+
+static void counted_free(void *pointer) {
+  if (pointer != nullptr) {
+    num_frees.fetch_add(1, std::memory_order_relaxed);
+    free(pointer);
+  }
+}
+
+void *operator new(size_t size) {
+  void *pointer = counted_malloc(size);
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return counted_malloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return counted_malloc(size);
+}
+
+void operator delete(void *pointer) noexcept {
+  counted_free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+  counted_free(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept {
+  counted_free(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept {
+  counted_free(pointer);
+}
+#else
+bool tracking_allocations() {
+  return false;
+}
+#endif
+
+AllocationCounts allocation_counts() {
+  AllocationCounts counts;
+  counts.allocations = num_allocations.load(std::memory_order_relaxed);
+  counts.frees = num_frees.load(std::memory_order_relaxed);
+  counts.bytes = num_bytes.load(std::memory_order_relaxed);
+  return counts;
+}
@@ -0,0 +1,16 @@
+#ifndef ALLOCATIONTRACKER_H
+#define ALLOCATIONTRACKER_H
+#include <stdint.h>
+
+// Totals of the global operator new/delete since startup. They are only
+// counted in builds with -DTRACK_ALLOCATIONS (make profile); otherwise
+// tracking_allocations() is false and the totals stay at zero.
+struct AllocationCounts{
+  uint64_t allocations;
+  uint64_t frees;
+  uint64_t bytes; // requested by the allocations
+};
+
+bool tracking_allocations();
+AllocationCounts allocation_counts();
+#endif
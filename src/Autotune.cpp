@@ -0,0 +1,99 @@
+#include "Autotune.hpp"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+const char *TUNING_FILE = "starswift.tune";
+
+std::string host_name() {
+  char name[256];
+  if (gethostname(name, sizeof(name)) != 0) {
+    return "unknown";
+  }
+  name[sizeof(name) - 1] = '\0';
+  return name;
+}
+
+// "host stars threads leaf_capacity double|float step_ms"
+static bool parse_line(const std::string &line, std::string *host, TunedSettings *settings) {
+  std::istringstream words(line);
+  std::string kernel;
+  if (!(words >> *host >> settings->num_stars >> settings->threads >> settings->leaf_capacity >> kernel >> settings->step_ms)) {
+    return false;
+  }
+  settings->float_forces = kernel == "float";
+  return settings->num_stars > 0 && settings->threads > 0 && settings->leaf_capacity > 0;
+}
+
+bool find_tuned_settings(const char *path, int num_stars, TunedSettings *settings) {
+  std::ifstream file(path);
+  std::string host = host_name();
+  std::string line;
+  double nearest = 1; // log2 of the star count ratio
+  bool found = false;
+  while (std::getline(file, line)) {
+    std::string line_host;
+    TunedSettings line_settings;
+    if (line.empty() || line[0] == '#' || !parse_line(line, &line_host, &line_settings) || line_host != host) {
+      continue;
+    }
+    double distance = std::fabs(std::log2((double)line_settings.num_stars/std::max(1, num_stars)));
+    if (distance <= nearest) {
+      nearest = distance;
+      *settings = line_settings;
+      found = true;
+    }
+  }
+  return found;
+}
+
+bool save_tuned_settings(const char *path, const TunedSettings &settings, std::string *error) {
+  // every other host's and star count's lines stay as they were
+  std::vector<std::string> lines;
+  std::ifstream old_file(path);
+  std::string host = host_name();
+  std::string line;
+  while (std::getline(old_file, line)) {
+    std::string line_host;
+    TunedSettings line_settings;
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    if (parse_line(line, &line_host, &line_settings) && line_host == host && line_settings.num_stars == settings.num_stars) {
+      continue;
+    }
+    lines.push_back(line);
+  }
+  old_file.close();
+
+  std::string temporary = std::string(path) + ".tmp";
+  FILE *file = fopen(temporary.c_str(), "w");
+  if (file == nullptr) {
+    if (error != nullptr) {
+      *error = std::string("could not create ") + temporary + ": " + strerror(errno);
+    }
+    return false;
+  }
+  fprintf(file, "# written by --autotune: host stars threads leaf_capacity kernel step_ms\n");
+  for (size_t i = 0; i < lines.size(); i++) {
+    fprintf(file, "%s\n", lines[i].c_str());
+  }
+  fprintf(file, "%s %d %d %d %s %.3f\n", host.c_str(), settings.num_stars, settings.threads, settings.leaf_capacity,
+          settings.float_forces ? "float" : "double", settings.step_ms);
+  bool ok = !ferror(file);
+  ok = fclose(file) == 0 && ok;
+  ok = ok && rename(temporary.c_str(), path) == 0;
+  if (!ok) {
+    if (error != nullptr) {
+      *error = std::string("could not write ") + path;
+    }
+    unlink(temporary.c_str());
+  }
+  return ok;
+}
@@ -0,0 +1,24 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+#include <string>
+
+// The fastest settings --autotune found on a host for a star count.
+struct TunedSettings{
+  int num_stars;
+  int threads;
+  int leaf_capacity;
+  bool float_forces;
+  double step_ms; // what they took there
+};
+
+// kept in the working directory, one line per host and star count
+extern const char *TUNING_FILE;
+
+// the name of this machine, which its settings are filed under
+std::string host_name();
+// The settings tuned on this host for the star count nearest num_stars,
+// provided it is within a factor of two. False when there are none.
+bool find_tuned_settings(const char *path, int num_stars, TunedSettings *settings);
+// Files the settings under this host, replacing any for the same star count.
+bool save_tuned_settings(const char *path, const TunedSettings &settings, std::string *error);
+#endif
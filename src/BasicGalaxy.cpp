@@ -0,0 +1,189 @@
+#include "BasicGalaxy.hpp"
+#include <algorithm>
+#include <cmath>
+
+// used until a galaxy is handed a real pool; it never starts a thread
+static TaskScheduler serial_scheduler(1);
+
+GalaxySettings::GalaxySettings() {
+  gravity_strength = 200.f;
+  max_speed = 100.0f;
+  theta = 1.7f;
+  soft_power = 2;
+  reorder_interval = 10;
+  float_forces = false;
+  leaf_capacity = 1;
+  cost_zones = true;
+  collect_stats = false;
+}
+
+template <int Dim>
+BasicGalaxy<Dim>::BasicGalaxy(int num_stars)
+  : tree(200.f, 100.0f, 1.7f, 2) {
+  resize(num_stars);
+
+  step_number = 0;
+  for (int axis = 0; axis < Dim; axis++) {
+    root_corner[axis] = 0;
+    center_of_mass[axis] = 0;
+  }
+  root_size = 1;
+
+  scheduler = &serial_scheduler;
+  profiler = nullptr;
+}
+
+template <int Dim>
+int BasicGalaxy<Dim>::num_stars() const {
+  return (int)stars.size();
+}
+
+template <int Dim>
+typename BasicGalaxy<Dim>::Star *BasicGalaxy<Dim>::star(int id) {
+  return &stars[star_slots[id]];
+}
+
+// Changes the number of stars and resets their ids; the stars themselves
+// are left for the caller to fill in.
+template <int Dim>
+void BasicGalaxy<Dim>::resize(int num_stars) {
+  stars.resize(num_stars);
+  star_ids.resize(num_stars);
+  star_slots.resize(num_stars);
+  star_costs.assign(num_stars, 0);
+  for (int i = 0; i < num_stars; i++) {
+    star_ids[i] = i;
+    star_slots[i] = i;
+  }
+}
+
+template <int Dim>
+void BasicGalaxy<Dim>::take_settings(const GalaxySettings &settings) {
+  GalaxySettings::operator=(settings);
+}
+
+template <int Dim>
+void BasicGalaxy<Dim>::build_tree() {
+  ScopedTimer timer(profiler, PHASE_TREE_BUILD);
+  {
+    TraceScope trace("Bounds");
+    Tree::compute_bounds(stars.data(), num_stars(), *scheduler, root_corner, &root_size);
+  }
+  tree.set_parameters(gravity_strength, max_speed, theta, soft_power);
+  tree.float_forces = float_forces;
+  tree.leaf_capacity = std::max(1, leaf_capacity);
+  tree.collect_stats = collect_stats;
+  tree.build(stars.data(), num_stars(), root_corner, root_size, *scheduler);
+  for (int axis = 0; axis < Dim; axis++) {
+    center_of_mass[axis] = tree.center_of_mass[axis];
+  }
+}
+
+template <int Dim>
+void BasicGalaxy<Dim>::start_step() {
+  build_tree();
+  if (reorder_interval > 0 && step_number % reorder_interval == 0) {
+    ScopedTimer timer(profiler, PHASE_TREE_BUILD);
+    TraceScope trace("Morton Reorder");
+    reorder_stars();
+  }
+}
+
+template <int Dim>
+void BasicGalaxy<Dim>::finish_step(double dt) {
+  {
+    ScopedTimer timer(profiler, PHASE_INTEGRATION);
+    tree.update_motion(num_stars(), dt, *scheduler);
+  }
+  step_number++;
+}
+
+template <int Dim>
+void BasicGalaxy<Dim>::step(double dt) {
+  start_step();
+  {
+    ScopedTimer timer(profiler, PHASE_FORCE_WALK);
+    compute_tree_forces();
+  }
+  finish_step(dt);
+}
+
+template <int Dim>
+void BasicGalaxy<Dim>::compute_tree_forces() {
+  tree.update_gravity(num_stars(), cost_zones ? star_costs.data() : nullptr, *scheduler);
+}
+
+// Moves the stars into the Morton (Z-order) order of the current tree, so
+// stars that are close in space are close in memory and share most of their
+// walk. The tree stays valid: its order simply becomes the identity.
+template <int Dim>
+void BasicGalaxy<Dim>::reorder_stars() {
+  int n = num_stars();
+  reorder_buffer.resize(n);
+  reorder_ids.resize(n);
+  reorder_costs.resize(n);
+  auto gather = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      int old_slot = tree.order[i];
+      reorder_buffer[i] = stars[old_slot];
+      reorder_ids[i] = star_ids[old_slot];
+      reorder_costs[i] = star_costs[old_slot];
+    }
+  };
+  scheduler->parallel_for(0, n, 4096, gather);
+  stars.swap(reorder_buffer);
+  star_ids.swap(reorder_ids);
+  star_costs.swap(reorder_costs);
+  auto remap = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      star_slots[star_ids[i]] = i;
+      tree.order[i] = i;
+    }
+  };
+  scheduler->parallel_for(0, n, 4096, remap);
+  tree.stars = stars.data();
+}
+
+// Energy readout of the stats panel, summed per chunk and then over chunks.
+template <int Dim>
+void BasicGalaxy<Dim>::compute_energy(double *kinetic, double *potential) {
+  typedef typename Tree::Traits Traits;
+  ScopedTimer timer(profiler, PHASE_ENERGY);
+  const int max_chunks = 64;
+  double partial_kinetic[max_chunks];
+  double partial_potential[max_chunks];
+  int n = num_stars();
+  int chunk = std::max(4096, (n + max_chunks - 1)/max_chunks);
+  int num_chunks = (n + chunk - 1)/chunk;
+  auto sum_chunks = [&](int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      double k = 0;
+      double u = 0;
+      for (int i = c*chunk; i < std::min((c + 1)*chunk, n); i++) {
+        double speed_squared = 0;
+        double pull_squared = 0;
+        for (int axis = 0; axis < Dim; axis++) {
+          double v = Traits::velocity(stars[i], axis);
+          double a = Traits::acceleration(stars[i], axis);
+          speed_squared += v*v;
+          pull_squared += a*a;
+        }
+        k += gravity_strength*std::sqrt(speed_squared); // 1/2mv^2
+        u -= gravity_strength*std::sqrt(pull_squared);
+      }
+      partial_kinetic[c] = k;
+      partial_potential[c] = u;
+    }
+  };
+  scheduler->parallel_for(0, num_chunks, 1, sum_chunks);
+
+  *kinetic = 0;
+  *potential = 0;
+  for (int c = 0; c < num_chunks; c++) {
+    *kinetic += partial_kinetic[c];
+    *potential += partial_potential[c];
+  }
+}
+
+template class BasicGalaxy<2>;
+template class BasicGalaxy<3>;
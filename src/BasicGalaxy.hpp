@@ -0,0 +1,77 @@
+#ifndef BASIC_GALAXY_H
+#define BASIC_GALAXY_H
+#include <vector>
+#include "SpatialTree.hpp"
+#include "Profiler.hpp"
+
+// What the sliders, scenario keys and timeline set, shared by the 2D and 3D
+// galaxies so either can take the other's.
+struct GalaxySettings{
+  // tunable
+  // ========
+  float gravity_strength;
+  float max_speed;
+  float theta;
+  int soft_power;
+  int reorder_interval; // steps between Morton reorders, 0 disables
+  bool float_forces;    // single precision force evaluation
+  int leaf_capacity;    // stars a tree leaf may hold
+  bool cost_zones;      // balance the force walk by last step's star costs
+  bool collect_stats;   // fill tree.tree_stats and tree.walk_stats every step
+  // ========
+
+  GalaxySettings();
+};
+
+// The stars of a galaxy in Dim dimensions and the Barnes-Hut step over
+// their tree: build, reorder when due, walk, integrate.
+template <int Dim>
+class BasicGalaxy : public GalaxySettings{
+
+public:
+  typedef SpatialTree<Dim, double> Tree;
+  typedef typename Tree::Body Star;
+
+  // stars are stored contiguously and may be reordered in memory;
+  // star_ids/star_slots translate between a slot and the star's stable id
+  std::vector<Star> stars;
+  std::vector<int> star_ids;   // slot -> id
+  std::vector<int> star_slots; // id -> slot
+  std::vector<int> star_costs; // slot -> interactions in the last force walk
+
+  long step_number;
+
+  // state of the most recent tree
+  double root_corner[Dim];
+  double root_size;
+  double center_of_mass[Dim];
+
+  Tree tree;                // its walls are set by the owner
+  TaskScheduler *scheduler; // shared by every phase, a single worker unless set
+  Profiler *profiler;       // optional per-phase timings
+
+public:
+  BasicGalaxy(int num_stars);
+  int num_stars() const;
+  Star *star(int id);
+  void resize(int num_stars);
+  void take_settings(const GalaxySettings &settings);
+  void build_tree();
+  void step(double dt);
+  // the walk's accelerations for every star, from the current tree
+  void compute_tree_forces();
+  void reorder_stars();
+  void compute_energy(double *kinetic, double *potential);
+
+protected:
+  // the tree, and the Morton reorder when one is due
+  void start_step();
+  // integrates the stars and counts the step
+  void finish_step(double dt);
+
+private:
+  std::vector<Star> reorder_buffer;
+  std::vector<int> reorder_ids;
+  std::vector<int> reorder_costs;
+};
+#endif
@@ -0,0 +1,35 @@
+#ifndef BODY_H
+#define BODY_H
+#include "Point.hpp"
+
+// A star in Dim dimensions with Scalar coordinates. Unlike Point it has no
+// colour: the render pass works that out as it projects the star.
+template <int Dim, typename Scalar>
+struct Body{
+  Scalar position[Dim];
+  Scalar velocity[Dim];
+  Scalar acceleration[Dim];
+};
+
+// How the tree and the integrator reach a star's coordinates, one axis at a
+// time. The axis is a constant in every (unrolled) loop that asks, so these
+// come down to plain field accesses.
+template <int Dim, typename Scalar>
+struct BodyTraits{
+  typedef Body<Dim, Scalar> body;
+  static Scalar &position(body &b, int axis) { return b.position[axis]; }
+  static Scalar &velocity(body &b, int axis) { return b.velocity[axis]; }
+  static Scalar &acceleration(body &b, int axis) { return b.acceleration[axis]; }
+  static const Scalar &position(const body &b, int axis) { return b.position[axis]; }
+};
+
+// the 2D galaxy's own stars
+template <>
+struct BodyTraits<2, double>{
+  typedef Point body;
+  static double &position(Point &p, int axis) { return axis == 0 ? p.x : p.y; }
+  static double &velocity(Point &p, int axis) { return axis == 0 ? p.vx : p.vy; }
+  static double &acceleration(Point &p, int axis) { return axis == 0 ? p.ax : p.ay; }
+  static const double &position(const Point &p, int axis) { return axis == 0 ? p.x : p.y; }
+};
+#endif
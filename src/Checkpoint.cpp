@@ -0,0 +1,138 @@
+#include "Checkpoint.hpp"
+#include <chrono>
+#include "Tracer.hpp"
+
+static double now_seconds() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Checkpointer::Checkpointer() {
+  checkpoints_written.store(0);
+  last_step_written.store(-1);
+  every_steps = 0;
+  every_seconds = 0;
+  last_step = 0;
+  last_time = 0;
+  pending = false;
+  stopping = false;
+  failed = false;
+}
+
+Checkpointer::~Checkpointer() {
+  finish(nullptr);
+}
+
+void Checkpointer::start(const char *path, long every_steps, double every_seconds) {
+  finish(nullptr);
+  this->path = path;
+  this->every_steps = every_steps;
+  this->every_seconds = every_seconds;
+  last_step = -1;
+  last_time = now_seconds();
+  checkpoints_written.store(0);
+  last_step_written.store(-1);
+  pending = false;
+  stopping = false;
+  failed = false;
+  failure.clear();
+  thread = std::thread(&Checkpointer::writer_loop, this);
+}
+
+bool Checkpointer::is_running() const {
+  return thread.joinable();
+}
+
+bool Checkpointer::after_step(Galaxy &galaxy) {
+  if (!is_running()) {
+    return false;
+  }
+  if (last_step < 0) {
+    last_step = galaxy.step_number;
+  }
+  bool due = (every_steps > 0 && galaxy.step_number - last_step >= every_steps)
+             || (every_seconds > 0 && now_seconds() - last_time >= every_seconds);
+  if (!due) {
+    return false;
+  }
+  {
+    // still writing the last one, try again after the next step
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pending) {
+      return false;
+    }
+  }
+  stage(galaxy);
+  return true;
+}
+
+void Checkpointer::checkpoint(Galaxy &galaxy) {
+  if (!is_running()) {
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (pending) {
+      done.wait(lock);
+    }
+  }
+  stage(galaxy);
+}
+
+bool Checkpointer::finish(std::string *error) {
+  if (!is_running()) {
+    return true;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  work.notify_one();
+  thread.join();
+  if (failed && error != nullptr) {
+    *error = failure;
+  }
+  return !failed;
+}
+
+// the only part the step loop pays for: a parallel copy of the stars
+void Checkpointer::stage(Galaxy &galaxy) {
+  TraceScope trace("Checkpoint Copy");
+  staging.capture(galaxy);
+  last_step = galaxy.step_number;
+  last_time = now_seconds();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending = true;
+  }
+  work.notify_one();
+}
+
+void Checkpointer::writer_loop() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (!pending && !stopping) {
+        work.wait(lock);
+      }
+      if (!pending) {
+        return;
+      }
+    }
+
+    std::string error;
+    if (staging.write(path.c_str(), &error)) {
+      checkpoints_written++;
+      last_step_written.store(staging.header.step_number);
+    }
+    else {
+      failed = true;
+      failure = error;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending = false;
+    }
+    done.notify_all();
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Galaxy.hpp"
+#include "Snapshot.hpp"
+
+// Writes periodic snapshots of a running galaxy without holding it up. When
+// a checkpoint is due the stars are copied into a staging SnapshotData and a
+// background thread writes it out, replacing the checkpoint file atomically.
+// A checkpoint that falls due while the previous one is still being written
+// waits for it to finish rather than making the step loop wait.
+class Checkpointer{
+
+public:
+  std::atomic<long> checkpoints_written;
+  std::atomic<long> last_step_written; // step number of the newest complete checkpoint, -1 if none
+
+public:
+  Checkpointer();
+  ~Checkpointer();
+  // every_steps or every_seconds may be 0 to check only the other one
+  void start(const char *path, long every_steps, double every_seconds);
+  bool is_running() const;
+  // call after every step; returns true if a checkpoint was staged
+  bool after_step(Galaxy &galaxy);
+  // stages a checkpoint now, waiting for a write still in progress
+  void checkpoint(Galaxy &galaxy);
+  // waits for the last write and stops the thread; false if any write failed
+  bool finish(std::string *error);
+
+private:
+  std::string path;
+  long every_steps;
+  double every_seconds;
+  long last_step;    // step number of the last staged checkpoint
+  double last_time;  // seconds, when it was staged
+
+  SnapshotData staging;
+  bool pending;      // staging holds a checkpoint the thread has not written yet
+  bool stopping;
+  bool failed;
+  std::string failure;
+  std::mutex mutex;
+  std::condition_variable work;
+  std::condition_variable done;
+  std::thread thread;
+
+  void stage(Galaxy &galaxy);
+  void writer_loop();
+
+  Checkpointer(const Checkpointer &);
+  Checkpointer &operator=(const Checkpointer &);
+};
+#endif
@@ -0,0 +1,87 @@
+#include "ForceSolver.hpp"
+#include <cmath>
+#include <string.h>
+#include "Galaxy.hpp"
+#include "Gravity.hpp"
+
+const char *solver_names[SOLVER_COUNT] = {"barnes-hut", "direct"};
+
+const double PI = 3.14159265358979323846;
+
+int find_solver(const char *name) {
+  for (int solver = 0; solver < SOLVER_COUNT; solver++) {
+    if (strcmp(name, solver_names[solver]) == 0) {
+      return solver;
+    }
+  }
+  return -1;
+}
+
+bool ForceSolver::compute_potentials(Galaxy &galaxy, double *potentials) {
+  (void)galaxy;
+  (void)potentials;
+  return false;
+}
+
+void BarnesHutSolver::compute_forces(Galaxy &galaxy) {
+  galaxy.compute_tree_forces();
+}
+
+void DirectSolver::compute_forces(Galaxy &galaxy) {
+  if (galaxy.float_forces) {
+    sum_forces<float>(galaxy, x_float, y_float, ones_float);
+  }
+  else {
+    sum_forces<double>(galaxy, x, y, ones);
+  }
+}
+
+template <typename Real>
+void DirectSolver::sum_forces(Galaxy &galaxy, std::vector<Real> &x, std::vector<Real> &y, std::vector<Real> &ones) {
+  int n = galaxy.num_stars();
+  const QuadTree &tree = galaxy.tree;
+  x.resize(n);
+  y.resize(n);
+  ones.assign(n, 1);
+  auto gather = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      x[i] = (Real)(galaxy.stars[i].x - tree.origin[0]);
+      y[i] = (Real)(galaxy.stars[i].y - tree.origin[1]);
+    }
+  };
+  galaxy.scheduler->parallel_for(0, n, 4096, gather);
+  Real softening_squared = (Real)tree.softening_squared;
+  const Real *others[2] = {x.data(), y.data()};
+  auto sum_stars = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      Real position[2] = {x[i], y[i]};
+      Real a[2] = {0, 0};
+      calculate_gravity<2, Real>(position, others, ones.data(), n, softening_squared, a);
+      galaxy.stars[i].ax = tree.point_mass*a[0];
+      galaxy.stars[i].ay = tree.point_mass*a[1];
+    }
+  };
+  galaxy.scheduler->parallel_for(0, n, 16, sum_stars);
+}
+
+// The kernel's pull G/(r^2 + s^2) comes from -(G/s)(pi/2 - atan(r/s)), which
+// is zero far away.
+bool DirectSolver::compute_potentials(Galaxy &galaxy, double *potentials) {
+  int n = galaxy.num_stars();
+  double softening = std::sqrt(galaxy.tree.softening_squared);
+  double gravity = galaxy.tree.point_mass;
+  auto sum_stars = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      double sum = 0;
+      for (int j = 0; j < n; j++) {
+        double dx = galaxy.stars[j].x - galaxy.stars[i].x;
+        double dy = galaxy.stars[j].y - galaxy.stars[i].y;
+        double radius = std::sqrt(dx*dx + dy*dy);
+        sum += j != i ? PI/2 - std::atan(radius/softening) : 0;
+      }
+      potentials[i] = -gravity/softening*sum;
+    }
+  };
+  galaxy.scheduler->parallel_for(0, n, 16, sum_stars);
+  return true;
+}
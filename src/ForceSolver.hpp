@@ -0,0 +1,54 @@
+#ifndef FORCE_SOLVER_H
+#define FORCE_SOLVER_H
+#include <vector>
+
+class Galaxy;
+
+enum SolverKind {
+  SOLVER_BARNES_HUT, // the quadtree walk, O(n log n) within theta
+  SOLVER_DIRECT,     // every pair, O(n^2) and exact
+  SOLVER_COUNT
+};
+
+extern const char *solver_names[SOLVER_COUNT];
+// the solver called `name` (as in solver_names), -1 if there is none
+int find_solver(const char *name);
+
+// Fills in the stars' accelerations from their positions. Solvers run after
+// Galaxy::build_tree(), whose bounds, center of mass and star order the
+// galaxy needs whatever the solver, and use the galaxy's gravity, softening,
+// precision and scheduler.
+class ForceSolver{
+
+public:
+  virtual ~ForceSolver() {}
+  virtual void compute_forces(Galaxy &galaxy) = 0;
+  // Each star's potential energy per unit mass, for solvers that can give
+  // one; false (and nothing written) for those that cannot.
+  virtual bool compute_potentials(Galaxy &galaxy, double *potentials);
+};
+
+class BarnesHutSolver : public ForceSolver{
+
+public:
+  void compute_forces(Galaxy &galaxy);
+};
+
+class DirectSolver : public ForceSolver{
+
+public:
+  void compute_forces(Galaxy &galaxy);
+  bool compute_potentials(Galaxy &galaxy, double *potentials);
+
+private:
+  // positions relative to the root centre, side by side for the kernel
+  std::vector<double> x;
+  std::vector<double> y;
+  std::vector<double> ones;
+  std::vector<float> x_float;
+  std::vector<float> y_float;
+  std::vector<float> ones_float;
+
+  template <typename Real> void sum_forces(Galaxy &galaxy, std::vector<Real> &x, std::vector<Real> &y, std::vector<Real> &ones);
+};
+#endif
@@ -0,0 +1,144 @@
+#include "Galaxy.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// stars compared against exact summation for the adaptive theta
+const int FORCE_ERROR_SAMPLES = 32;
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+Galaxy::Galaxy(int num_stars, double screen_width, double screen_height)
+  : BasicGalaxy<2>(num_stars) {
+  solver = SOLVER_BARNES_HUT;
+
+  this->screen_width = screen_width;
+  this->screen_height = screen_height;
+  tree.walls[0] = screen_width;
+  tree.walls[1] = screen_height;
+}
+
+Galaxy3D::Galaxy3D(int num_stars, double width, double height, double depth)
+  : BasicGalaxy<3>(num_stars) {
+  tree.walls[0] = width;
+  tree.walls[1] = height;
+  tree.walls[2] = depth;
+}
+
+ForceSolver *Galaxy::force_solver() {
+  switch (solver) {
+    case SOLVER_DIRECT:
+      return &direct_solver;
+    default:
+      return &barnes_hut_solver;
+  }
+}
+
+void Galaxy::step(double dt) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  start_step();
+  {
+    ScopedTimer timer(profiler, PHASE_FORCE_WALK);
+    force_solver()->compute_forces(*this);
+  }
+  // theta only means something to the walk
+  bool adapt_theta = solver == SOLVER_BARNES_HUT && theta_controller.mode != THETA_FIXED;
+  // while the tree still matches the positions; not part of the step time
+  double sample_ms = 0;
+  if (adapt_theta && step_number % std::max(1, theta_controller.sample_interval) == 0) {
+    std::chrono::steady_clock::time_point sample_start = std::chrono::steady_clock::now();
+    sample_force_error();
+    sample_ms = elapsed_ms(sample_start);
+  }
+  finish_step(dt);
+  float adapted = theta_controller.update(theta, elapsed_ms(start) - sample_ms);
+  theta = solver == SOLVER_BARNES_HUT ? adapted : theta;
+}
+
+// Nothing a step computes depends on the number of workers or on which one
+// runs what: every star sums its forces alone in the tree's order, the tree
+// comes out the same whoever builds it, and reductions are over fixed
+// chunks. The same settings give the same stars on any number of threads.
+uint64_t Galaxy::state_hash() const {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  auto add = [&](const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t k = 0; k < size; k++) {
+      hash = (hash ^ bytes[k])*0x100000001b3ULL;
+    }
+  };
+  add(&step_number, sizeof(step_number));
+  for (int id = 0; id < num_stars(); id++) {
+    const Point &p = stars[star_slots[id]];
+    double state[4] = {p.x, p.y, p.vx, p.vy};
+    add(state, sizeof(state));
+  }
+  return hash;
+}
+
+void Galaxy::exact_acceleration(double x, double y, double *ax, double *ay) const {
+  double softening = std::pow(10, soft_power);
+  double softening_squared = softening*softening;
+  double sum_x = 0;
+  double sum_y = 0;
+  for (int j = 0; j < num_stars(); j++) {
+    double dx = stars[j].x - x;
+    double dy = stars[j].y - y;
+    double radius_squared = dx*dx + dy*dy;
+    double radius = std::sqrt(radius_squared);
+    double a_over_r = radius_squared > 0 ? 1/((radius_squared + softening_squared)*radius) : 0;
+    sum_x += a_over_r*dx;
+    sum_y += a_over_r*dy;
+  }
+  *ax = gravity_strength*sum_x;
+  *ay = gravity_strength*sum_y;
+}
+
+// Median relative error of the walk's accelerations over a few stars spread
+// through the slots, a different few each time, and their interaction count.
+void Galaxy::sample_force_error() {
+  int n = num_stars();
+  int num_samples = std::min(n, FORCE_ERROR_SAMPLES);
+  if (num_samples == 0) {
+    return;
+  }
+  sample_errors.resize(num_samples);
+  sample_interactions.resize(num_samples);
+  int offset = (int)(step_number/std::max(1, theta_controller.sample_interval) % std::max(1, n/num_samples));
+  auto sample_stars = [&](int begin, int end) {
+    for (int k = begin; k < end; k++) {
+      const Point &star = stars[(int)((int64_t)k*n/num_samples) + offset];
+      Point walked = star;
+      walked.ax = 0;
+      walked.ay = 0;
+      sample_interactions[k] = tree.update_point_gravity(&walked);
+      double exact_ax, exact_ay;
+      exact_acceleration(star.x, star.y, &exact_ax, &exact_ay);
+      double ex = walked.ax - exact_ax;
+      double ey = walked.ay - exact_ay;
+      double magnitude = std::sqrt(exact_ax*exact_ax + exact_ay*exact_ay);
+      sample_errors[k] = magnitude > 0 ? std::sqrt(ex*ex + ey*ey)/magnitude : 0;
+    }
+  };
+  scheduler->parallel_for(0, num_samples, 1, sample_stars);
+  long interactions = 0;
+  for (int k = 0; k < num_samples; k++) {
+    interactions += sample_interactions[k];
+  }
+  std::nth_element(sample_errors.begin(), sample_errors.begin() + num_samples/2, sample_errors.end());
+  theta_controller.force_error = sample_errors[num_samples/2];
+  theta_controller.interactions = (double)interactions/num_samples;
+  theta_controller.new_sample = true;
+}
+
+void Galaxy::update_colors(double max_distance, double galaxy_r, double galaxy_g, double galaxy_b, int color_mode) {
+  ScopedTimer timer(profiler, PHASE_COLORING);
+  auto color_stars = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      stars[i].update_star_color(center_of_mass[0], center_of_mass[1], max_distance, max_speed, galaxy_r, galaxy_g, galaxy_b, color_mode);
+    }
+  };
+  scheduler->parallel_for(0, num_stars(), 4096, color_stars);
+}
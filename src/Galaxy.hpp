@@ -0,0 +1,50 @@
+#ifndef GALAXY_H
+#define GALAXY_H
+#include <stdint.h>
+#include <vector>
+#include "ForceSolver.hpp"
+#include "BasicGalaxy.hpp"
+#include "ThetaController.hpp"
+
+// The 2D galaxy the window shows, with a choice of force solver and a theta
+// that can adapt to the step time or force error.
+class Galaxy : public BasicGalaxy<2>{
+
+public:
+  // tunable, with those of GalaxySettings
+  // ========
+  int solver;           // SolverKind, the force_solver() every step uses
+  ThetaController theta_controller; // sets theta after every Barnes-Hut step unless off
+  // ========
+
+  double screen_width;
+  double screen_height;
+
+public:
+  Galaxy(int num_stars, double screen_width, double screen_height);
+  ForceSolver *force_solver();
+  void step(double dt);
+  void update_colors(double max_distance, double galaxy_r, double galaxy_g, double galaxy_b, int color_mode);
+  // FNV-1a of the step number and every star's position and velocity bits,
+  // in id order; equal hashes mean bit-identical runs
+  uint64_t state_hash() const;
+  // exact summation over every star, with the tree's softened kernel
+  void exact_acceleration(double x, double y, double *ax, double *ay) const;
+
+private:
+  BarnesHutSolver barnes_hut_solver;
+  DirectSolver direct_solver;
+  std::vector<double> sample_errors;
+  std::vector<int> sample_interactions;
+
+  void sample_force_error();
+};
+
+// A galaxy in three dimensions, stepped by Barnes-Hut over an octree inside
+// a box it bounces off. There is no direct solver or adaptive theta here.
+class Galaxy3D : public BasicGalaxy<3>{
+
+public:
+  Galaxy3D(int num_stars, double width, double height, double depth);
+};
+#endif
@@ -0,0 +1,35 @@
+#ifndef GRAVITY_H
+#define GRAVITY_H
+#include <cmath>
+
+// Adds the pull of `count` bodies on a star at `p` to `a`, both Dim long.
+// other[axis][k] is body k's coordinate along the axis, other_stars[k] its
+// star count. The loop is branch free so the compiler can vectorize it; a
+// body sitting exactly on the star (itself) contributes nothing. Callers
+// scale the sum by the point mass.
+// TODO: scale point mass for realism
+template <int Dim, typename Real>
+inline void calculate_gravity(const Real *p, const Real *const *other, const Real *other_stars, int count, Real softening_squared, Real *a) {
+  Real sum[Dim];
+  for (int axis = 0; axis < Dim; axis++) {
+    sum[axis] = 0;
+  }
+  for (int k = 0; k < count; k++) {
+    Real d[Dim];
+    Real radius_squared = 0;
+    for (int axis = 0; axis < Dim; axis++) {
+      d[axis] = other[axis][k] - p[axis];
+      radius_squared += d[axis]*d[axis];
+    }
+    // a = m/(r^2 + soft^2) along d/r
+    Real radius = std::sqrt(radius_squared);
+    Real a_over_r = radius_squared > 0 ? other_stars[k]/((radius_squared + softening_squared)*radius) : 0;
+    for (int axis = 0; axis < Dim; axis++) {
+      sum[axis] += a_over_r*d[axis];
+    }
+  }
+  for (int axis = 0; axis < Dim; axis++) {
+    a[axis] += sum[axis];
+  }
+}
+#endif
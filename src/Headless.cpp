@@ -0,0 +1,860 @@
+#include "Headless.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <unistd.h>
+#include "AllocationTracker.hpp"
+#include "Autotune.hpp"
+#include "Checkpoint.hpp"
+#include "Galaxy.hpp"
+#include "InitialConditions.hpp"
+#include "Scenario.hpp"
+#include "Snapshot.hpp"
+#include "Trajectory.hpp"
+#include "Tracer.hpp"
+
+// same world as a typical window, so the galaxy matches the GUI
+const double WORLD_SIZE = 1000;
+const double WORLD_RADIUS = 100;
+// fixed time step of headless runs, one frame at 60 FPS
+const double HEADLESS_DT = 1.0/60;
+
+static int int_option(int argc, char* argv[], const char *name, int fallback) {
+  for (int i = 1; i + 1 < argc; i++) {
+    if (strcmp(argv[i], name) == 0) {
+      return atoi(argv[i+1]);
+    }
+  }
+  return fallback;
+}
+
+static const char *string_option(int argc, char* argv[], const char *name, const char *fallback) {
+  for (int i = 1; i + 1 < argc; i++) {
+    if (strcmp(argv[i], name) == 0) {
+      return argv[i+1];
+    }
+  }
+  return fallback;
+}
+
+static double double_option(int argc, char* argv[], const char *name, double fallback) {
+  for (int i = 1; i + 1 < argc; i++) {
+    if (strcmp(argv[i], name) == 0) {
+      return atof(argv[i+1]);
+    }
+  }
+  return fallback;
+}
+
+// replaces *path when the option is given
+static void path_option(int argc, char* argv[], const char *name, std::string *path) {
+  const char *option = string_option(argc, argv, name, nullptr);
+  if (option != nullptr) {
+    *path = option;
+  }
+}
+
+static bool flag_option(int argc, char* argv[], const char *name) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static double now_ms() {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Applies what --autotune found for this host and num_stars, unless the run
+// is untuned; --leaf-capacity and --threads still have the last word.
+static void use_tuning(int argc, char* argv[], Scenario *scenario, int num_stars) {
+  TunedSettings settings;
+  if (scenario->tuned && find_tuned_settings(TUNING_FILE, num_stars, &settings)) {
+    scenario->use_tuned_settings(settings);
+    scenario->leaf_capacity = int_option(argc, argv, "--leaf-capacity", scenario->leaf_capacity);
+    printf("tuned for %d stars: %d threads, leaf capacity %d, %s forces\n", settings.num_stars, scenario->threads,
+           scenario->leaf_capacity, scenario->float_forces ? "float" : "double");
+  }
+}
+
+// whether a headless run may take its stars from a snapshot or checkpoint
+static bool stars_from_file(int argc, char* argv[], const Scenario &scenario) {
+  return !scenario.snapshot_path.empty() || string_option(argc, argv, "--load", nullptr) != nullptr ||
+         flag_option(argc, argv, "--resume");
+}
+
+// The run's settings: the --scenario file if there is one, then what
+// --autotune found for this host (unless `tuned` is false or --untuned is
+// given), with any options given on the command line taking precedence.
+// When `loads_snapshots` and the stars come from --load or --resume, the
+// tuning waits for the caller to know their number. False if the file or
+// an option is invalid.
+static bool read_scenario(int argc, char* argv[], Scenario *scenario, bool tuned = true, bool loads_snapshots = false) {
+  const char *path = string_option(argc, argv, "--scenario", nullptr);
+  std::string error;
+  if (path != nullptr && !scenario->load(path, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return false;
+  }
+  scenario->tuned = scenario->tuned && tuned && !flag_option(argc, argv, "--untuned");
+  scenario->deterministic = scenario->deterministic || flag_option(argc, argv, "--deterministic");
+  scenario->num_stars = int_option(argc, argv, "--stars", scenario->num_stars);
+  scenario->dimensions = int_option(argc, argv, "--dimensions", scenario->dimensions);
+  if (scenario->dimensions != 2 && scenario->dimensions != 3) {
+    fprintf(stderr, "--dimensions must be 2 or 3\n");
+    return false;
+  }
+  scenario->threads = int_option(argc, argv, "--threads", scenario->threads);
+  if (!(loads_snapshots && scenario->dimensions == 2 && stars_from_file(argc, argv, *scenario))) {
+    use_tuning(argc, argv, scenario, scenario->num_stars);
+  }
+  InitialConditions &conditions = scenario->conditions;
+  const char *model = string_option(argc, argv, "--model", nullptr);
+  if (model != nullptr && (conditions.model = find_galaxy_model(model)) < 0) {
+    fprintf(stderr, "unknown model %s\n", model);
+    return false;
+  }
+  const char *seed = string_option(argc, argv, "--seed", nullptr);
+  if (seed != nullptr && !parse_seed(seed, &conditions.seed)) {
+    fprintf(stderr, "bad seed %s, expected a whole number from 0 to 2^64 - 1\n", seed);
+    return false;
+  }
+  conditions.radius = double_option(argc, argv, "--radius", conditions.radius);
+  conditions.num_galaxies = int_option(argc, argv, "--galaxies", conditions.num_galaxies);
+  path_option(argc, argv, "--load", &scenario->snapshot_path);
+  conditions.center_x = WORLD_SIZE/2;
+  conditions.center_y = WORLD_SIZE/2;
+  const char *solver = string_option(argc, argv, "--solver", nullptr);
+  if (solver != nullptr && (scenario->solver = find_solver(solver)) < 0) {
+    fprintf(stderr, "unknown solver %s\n", solver);
+    return false;
+  }
+  scenario->theta = (float)double_option(argc, argv, "--theta", scenario->theta);
+  scenario->leaf_capacity = int_option(argc, argv, "--leaf-capacity", scenario->leaf_capacity);
+  ThetaController &controller = scenario->theta_controller;
+  const char *adaptive = string_option(argc, argv, "--adaptive-theta", nullptr);
+  if (adaptive != nullptr && (controller.mode = find_theta_mode(adaptive)) < 0) {
+    fprintf(stderr, "unknown adaptive theta mode %s\n", adaptive);
+    return false;
+  }
+  controller.target_ms = double_option(argc, argv, "--target-ms", controller.target_ms);
+  controller.target_error = double_option(argc, argv, "--target-error", controller.target_error);
+  scenario->dt = double_option(argc, argv, "--dt", scenario->dt);
+  scenario->steps = int_option(argc, argv, "--steps", scenario->steps);
+  path_option(argc, argv, "--save", &scenario->save_path);
+  path_option(argc, argv, "--record", &scenario->record_path);
+  scenario->record_bits = int_option(argc, argv, "--record-bits", scenario->record_bits);
+  scenario->keyframe_interval = int_option(argc, argv, "--keyframe-interval", scenario->keyframe_interval);
+  path_option(argc, argv, "--checkpoint", &scenario->checkpoint_path);
+  path_option(argc, argv, "--summary", &scenario->summary_path);
+  scenario->checkpoint_every = int_option(argc, argv, "--checkpoint-every", scenario->checkpoint_every);
+  scenario->checkpoint_seconds = int_option(argc, argv, "--checkpoint-seconds", scenario->checkpoint_seconds);
+  std::string problem = scenario->nondeterminism();
+  if (!problem.empty()) {
+    fprintf(stderr, "%s\n", problem.c_str());
+    return false;
+  }
+  return true;
+}
+
+static int num_threads(const Scenario &scenario) {
+  return scenario.threads > 0 ? scenario.threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+// a path option, nullptr when it was left empty
+static const char *path_or_null(const std::string &path) {
+  return path.empty() ? nullptr : path.c_str();
+}
+
+// every mode but a plain --headless run simulates 2D galaxies only
+static bool two_dimensional(const Scenario &scenario, const char *mode) {
+  if (scenario.dimensions != 2) {
+    fprintf(stderr, "%s runs 2D galaxies only\n", mode);
+    return false;
+  }
+  return true;
+}
+
+// A loaded galaxy runs with the physics and adaptive theta saved alongside
+// its stars; lists the ones that differ from the command line and scenario,
+// which are dropped.
+static void report_overrides(const Scenario &scenario, const Galaxy &galaxy, const char *path) {
+  std::string overridden;
+  auto add = [&](const char *name, const char *kept, const char *given) {
+    overridden += std::string(overridden.empty() ? "" : ", ") + name + " " + kept + " (not " + given + ")";
+  };
+  auto note_text = [&](const char *name, const char *kept, const char *given) {
+    if (strcmp(kept, given) != 0) {
+      add(name, kept, given);
+    }
+  };
+  auto note = [&](const char *name, double kept, double given) {
+    if (kept != given) {
+      char kept_text[32], given_text[32];
+      snprintf(kept_text, sizeof(kept_text), "%g", kept);
+      snprintf(given_text, sizeof(given_text), "%g", given);
+      add(name, kept_text, given_text);
+    }
+  };
+  note_text("solver", solver_names[galaxy.solver], solver_names[scenario.solver]);
+  note("gravity", galaxy.gravity_strength, scenario.gravity_strength);
+  note("max_speed", galaxy.max_speed, scenario.max_speed);
+  note("theta", galaxy.theta, scenario.theta);
+  note("softening", galaxy.soft_power, scenario.soft_power);
+  note("float_forces", galaxy.float_forces, scenario.float_forces);
+  note("cost_zones", galaxy.cost_zones, scenario.cost_zones);
+  note("reorder_interval", galaxy.reorder_interval, scenario.reorder_interval);
+  note("leaf_capacity", galaxy.leaf_capacity, scenario.leaf_capacity);
+  const ThetaController &kept = galaxy.theta_controller;
+  const ThetaController &given = scenario.theta_controller;
+  note_text("adaptive_theta", theta_mode_names[kept.mode], theta_mode_names[given.mode]);
+  note("target_step_ms", kept.target_ms, given.target_ms);
+  note("target_error", kept.target_error, given.target_error);
+  note("min_theta", kept.min_theta, given.min_theta);
+  note("max_theta", kept.max_theta, given.max_theta);
+  if (!overridden.empty()) {
+    printf("%s keeps its own %s\n", path, overridden.c_str());
+  }
+}
+
+// The starting galaxy of a run, with the scenario's physics.
+static void generate_stars(Galaxy &galaxy, const Scenario &scenario) {
+  scenario.apply(galaxy);
+  double start = now_ms();
+  generate_initial_conditions(galaxy, scenario.conditions);
+  printf("generated %d stars (%s) in %.1f ms\n", galaxy.num_stars(), galaxy_model_names[scenario.conditions.model], now_ms() - start);
+}
+
+// Recomputes every star's acceleration with the galaxy's current settings,
+// returning the time the force walk took in milliseconds.
+static double compute_forces(Galaxy &galaxy) {
+  galaxy.build_tree();
+  double start = now_ms();
+  auto walk_stars = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      Point *p = &galaxy.stars[i];
+      p->ax = 0;
+      p->ay = 0;
+      galaxy.tree.update_point_gravity(p);
+    }
+  };
+  TraceScope trace("Force Walk");
+  galaxy.scheduler->parallel_for(0, galaxy.num_stars(), 256, walk_stars);
+  return now_ms() - start;
+}
+
+// Exact O(n^2) accelerations with the same softened kernel as the tree, in
+// double precision whatever the galaxy uses.
+static double compute_exact_forces(Galaxy &galaxy, std::vector<double> &ax, std::vector<double> &ay) {
+  double start = now_ms();
+  DirectSolver direct;
+  bool float_forces = galaxy.float_forces;
+  galaxy.float_forces = false;
+  {
+    TraceScope trace("Exact Forces");
+    direct.compute_forces(galaxy);
+  }
+  galaxy.float_forces = float_forces;
+  for (int i = 0; i < galaxy.num_stars(); i++) {
+    ax[i] = galaxy.stars[i].ax;
+    ay[i] = galaxy.stars[i].ay;
+  }
+  return now_ms() - start;
+}
+
+// Kinetic and potential energy of the stars, each of unit mass, with the
+// potential summed exactly.
+static void compute_total_energy(Galaxy &galaxy, std::vector<double> &potentials, double *kinetic, double *potential) {
+  DirectSolver direct;
+  potentials.resize(galaxy.num_stars());
+  direct.compute_potentials(galaxy, potentials.data());
+  *kinetic = 0;
+  *potential = 0;
+  for (int i = 0; i < galaxy.num_stars(); i++) {
+    const Point &p = galaxy.stars[i];
+    *kinetic += 0.5*(p.vx*p.vx + p.vy*p.vy);
+    *potential += 0.5*potentials[i];
+  }
+}
+
+// median, 99th percentile and maximum of the relative error of each star's
+// acceleration against the reference
+static void relative_errors(Galaxy &galaxy, const std::vector<double> &ref_ax, const std::vector<double> &ref_ay, double *median, double *p99, double *max) {
+  int n = galaxy.num_stars();
+  std::vector<double> errors(n);
+  for (int i = 0; i < n; i++) {
+    double ex = galaxy.stars[i].ax - ref_ax[i];
+    double ey = galaxy.stars[i].ay - ref_ay[i];
+    double magnitude = std::sqrt(ref_ax[i]*ref_ax[i] + ref_ay[i]*ref_ay[i]);
+    errors[i] = magnitude > 0 ? std::sqrt(ex*ex + ey*ey)/magnitude : 0;
+  }
+  std::sort(errors.begin(), errors.end());
+  *median = errors[n/2];
+  *p99 = errors[(int)(n*0.99)];
+  *max = errors[n-1];
+}
+
+static void print_tree_stats(const TreeStats &stats) {
+  printf("tree: %d nodes, %d leaves, depth %d (leaves %.1f on average), %.2f stars per leaf (max %d), %.0f%% of child slots used, %.2f MB\n\n",
+         stats.num_nodes, stats.num_leaves, stats.max_depth, stats.mean_leaf_depth, stats.mean_leaf_stars, stats.max_leaf_stars,
+         100*stats.child_occupancy, stats.memory_bytes/1048576.0);
+}
+
+int run_accuracy(int argc, char* argv[]) {
+  Scenario scenario;
+  if (!read_scenario(argc, argv, &scenario)) {
+    return 1;
+  }
+  if (!two_dimensional(scenario, "--accuracy")) {
+    return 1;
+  }
+  int num_stars = scenario.num_stars;
+  TaskScheduler scheduler(num_threads(scenario));
+
+  Galaxy galaxy(num_stars, WORLD_SIZE, WORLD_SIZE);
+  galaxy.scheduler = &scheduler;
+  generate_stars(galaxy, scenario);
+
+  galaxy.collect_stats = true;
+  galaxy.build_tree();
+  galaxy.collect_stats = false; // keep the timed walks free of counters
+  std::vector<double> exact_ax(num_stars), exact_ay(num_stars);
+  double exact_ms = compute_exact_forces(galaxy, exact_ax, exact_ay);
+  printf("%d stars, %d threads, exact summation %.1f ms\n\n", num_stars, scheduler.num_workers(), exact_ms);
+  print_tree_stats(galaxy.tree.tree_stats);
+  printf("%-7s %-7s %9s %8s %11s %11s %11s %13s\n", "theta", "forces", "walk ms", "speedup", "median err", "p99 err", "max err", "vs double max");
+
+  // the float walk is compared both to exact summation and to the double walk
+  // on the same tree, which isolates the precision loss from the theta error
+  const float thetas[] = {0.3f, 0.5f, 0.7f, 1.0f, 1.7f};
+  std::vector<double> double_ax(num_stars), double_ay(num_stars);
+  for (size_t t = 0; t < sizeof(thetas)/sizeof(thetas[0]); t++) {
+    double double_ms = 0;
+    for (int precision = 0; precision < 2; precision++) {
+      galaxy.theta = thetas[t];
+      galaxy.float_forces = precision == 1;
+      compute_forces(galaxy); // warm up
+      double ms = compute_forces(galaxy);
+
+      double median, p99, max;
+      relative_errors(galaxy, exact_ax, exact_ay, &median, &p99, &max);
+      if (precision == 0) {
+        double_ms = ms;
+        for (int i = 0; i < num_stars; i++) {
+          double_ax[i] = galaxy.stars[i].ax;
+          double_ay[i] = galaxy.stars[i].ay;
+        }
+        printf("%-7.2f %-7s %9.2f %8s %11.3e %11.3e %11.3e %13s\n", thetas[t], "double", ms, "", median, p99, max, "");
+      }
+      else {
+        double vs_median, vs_p99, vs_max;
+        relative_errors(galaxy, double_ax, double_ay, &vs_median, &vs_p99, &vs_max);
+        printf("%-7.2f %-7s %9.2f %7.2fx %11.3e %11.3e %11.3e %13.3e\n", thetas[t], "float", ms, double_ms/ms, median, p99, max, vs_max);
+      }
+    }
+  }
+
+  // traversal counters, measured in a separate untimed walk
+  printf("\n%-7s %12s %12s %11s %12s %12s\n", "theta", "opened/star", "tested/star", "MAC accept", "direct/star", "interactions");
+  galaxy.float_forces = false;
+  galaxy.collect_stats = true;
+  for (size_t t = 0; t < sizeof(thetas)/sizeof(thetas[0]); t++) {
+    galaxy.theta = thetas[t];
+    galaxy.build_tree();
+    galaxy.tree.update_gravity(num_stars, nullptr, scheduler);
+    const WalkStats &walk = galaxy.tree.walk_stats;
+    double walks = std::max(1L, walk.walks);
+    printf("%-7.2f %12.1f %12.1f %10.1f%% %12.1f %12.1f\n", thetas[t], walk.nodes_opened/walks, walk.cells_tested/walks,
+           walk.cells_tested > 0 ? 100.0*walk.cells_accepted/walk.cells_tested : 0.0, walk.direct_stars/walks, walk.interactions/walks);
+  }
+  return 0;
+}
+
+int run_check_allocs(int argc, char* argv[]) {
+  if (!tracking_allocations()) {
+    printf("allocations are not counted in this build, rebuild with make profile\n");
+    return 2;
+  }
+  Scenario scenario;
+  if (!read_scenario(argc, argv, &scenario)) {
+    return 1;
+  }
+  if (!two_dimensional(scenario, "--check-allocs")) {
+    return 1;
+  }
+  int num_stars = scenario.num_stars;
+  int warmup = int_option(argc, argv, "--warmup", 20);
+  int num_steps = scenario.steps;
+  TaskScheduler scheduler(num_threads(scenario));
+
+  Galaxy galaxy(num_stars, WORLD_SIZE, WORLD_SIZE);
+  galaxy.scheduler = &scheduler;
+  generate_stars(galaxy, scenario);
+
+  // the same work as a frame of the GUI
+  double kinetic, potential;
+  for (int step = 0; step < warmup + num_steps; step++) {
+    AllocationCounts before = allocation_counts();
+    galaxy.step(0.016);
+    galaxy.compute_energy(&kinetic, &potential);
+    galaxy.update_colors(WORLD_RADIUS, 0.0, 0.4, 1.0, 0);
+    AllocationCounts after = allocation_counts();
+
+    uint64_t allocations = after.allocations - before.allocations;
+    if (step >= warmup && allocations > 0) {
+      printf("step %d allocated %llu times (%llu bytes)\n", step, (unsigned long long)allocations,
+             (unsigned long long)(after.bytes - before.bytes));
+      return 1;
+    }
+  }
+  printf("%d stars, %d threads: no allocations in %d steps after %d warmup steps\n", num_stars, scheduler.num_workers(), num_steps, warmup);
+  return 0;
+}
+
+// A 3D galaxy's run: timed steps, with the timeline playing over a 2D
+// galaxy's settings that are copied across before every step. Snapshots,
+// recordings and checkpoints hold 2D stars, so there are none, and 3D
+// always walks the tree at a fixed theta.
+static int run_headless_3d(Scenario &scenario) {
+  if (!scenario.snapshot_path.empty() || !scenario.save_path.empty() || !scenario.record_path.empty() ||
+      !scenario.checkpoint_path.empty()) {
+    fprintf(stderr, "snapshots, recordings and checkpoints are 2D only\n");
+    return 1;
+  }
+  bool direct = scenario.solver != SOLVER_BARNES_HUT;
+  for (size_t i = 0; i < scenario.timeline.changes.size(); i++) {
+    const ParameterChange &change = scenario.timeline.changes[i];
+    direct = direct || (change.parameter == PARAM_SOLVER && (int)change.value != SOLVER_BARNES_HUT);
+  }
+  if (direct || scenario.theta_controller.mode != THETA_FIXED) {
+    fprintf(stderr, "the %s solver and adaptive theta are 2D only\n", solver_names[SOLVER_DIRECT]);
+    return 1;
+  }
+  double dt = scenario.dt > 0 ? scenario.dt : HEADLESS_DT;
+  TaskScheduler scheduler(num_threads(scenario));
+  Galaxy settings(0, WORLD_SIZE, WORLD_SIZE);
+  scenario.apply(settings);
+  Galaxy3D galaxy(scenario.num_stars, WORLD_SIZE, WORLD_SIZE, WORLD_SIZE);
+  galaxy.scheduler = &scheduler;
+  galaxy.take_settings(settings);
+  InitialConditions conditions = scenario.conditions;
+  conditions.center_z = WORLD_SIZE/2;
+  double generate_start = now_ms();
+  generate_initial_conditions(galaxy, conditions);
+  printf("generated %d stars (%s, 3D) in %.1f ms\n", galaxy.num_stars(), galaxy_model_names[conditions.model], now_ms() - generate_start);
+
+  long parameter_changes = 0;
+  double start = now_ms();
+  for (int step = 0; step < scenario.steps; step++) {
+    settings.step_number = galaxy.step_number;
+    parameter_changes += scenario.timeline.apply(settings);
+    galaxy.take_settings(settings);
+    galaxy.step(dt);
+  }
+  double elapsed = now_ms() - start;
+  printf("%d stars in 3D, %d threads: %d steps in %.1f ms (%.2f ms/step)\n", galaxy.num_stars(), scheduler.num_workers(),
+         scenario.steps, elapsed, scenario.steps > 0 ? elapsed/scenario.steps : 0.0);
+  if (!scenario.timeline.changes.empty()) {
+    printf("set %ld of %d timeline parameter changes\n", parameter_changes, (int)scenario.timeline.changes.size());
+  }
+  return 0;
+}
+
+int run_headless(int argc, char* argv[]) {
+  Scenario scenario;
+  if (!read_scenario(argc, argv, &scenario, true, true)) {
+    return 1;
+  }
+  if (scenario.dimensions == 3) {
+    return run_headless_3d(scenario);
+  }
+  int num_stars = scenario.num_stars;
+  int num_steps = scenario.steps;
+  double dt = scenario.dt > 0 ? scenario.dt : HEADLESS_DT;
+  const char *load_path = path_or_null(scenario.snapshot_path);
+  const char *save_path = path_or_null(scenario.save_path);
+  const char *record_path = path_or_null(scenario.record_path);
+  const char *checkpoint_path = path_or_null(scenario.checkpoint_path);
+  bool resume = flag_option(argc, argv, "--resume");
+
+  // a resumed run picks up from its checkpoint, if it got as far as one, and
+  // runs until the galaxy reaches --steps in total
+  if (resume && checkpoint_path == nullptr) {
+    fprintf(stderr, "--resume needs --checkpoint FILE\n");
+    return 1;
+  }
+  // a recording starts over when it is opened, losing the frames before the checkpoint
+  if (resume && record_path != nullptr) {
+    fprintf(stderr, "--resume cannot continue a --record trajectory, record the run without resuming\n");
+    return 1;
+  }
+  if (resume && access(checkpoint_path, F_OK) == 0) {
+    load_path = checkpoint_path;
+  }
+
+  SnapshotFile snapshot;
+  std::string error;
+  double load_start = now_ms();
+  if (load_path != nullptr && !snapshot.open(load_path, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  // read_scenario() left the tuning until the number of stars was known
+  if (stars_from_file(argc, argv, scenario)) {
+    use_tuning(argc, argv, &scenario, load_path != nullptr ? (int)snapshot.header->num_stars : num_stars);
+  }
+  TaskScheduler scheduler(num_threads(scenario));
+  // a loaded galaxy keeps the walls of the window it was simulated in
+  double world_width = load_path != nullptr ? snapshot.header->world_width : WORLD_SIZE;
+  double world_height = load_path != nullptr ? snapshot.header->world_height : WORLD_SIZE;
+  Galaxy galaxy(load_path != nullptr ? 0 : num_stars, world_width, world_height);
+  galaxy.scheduler = &scheduler;
+  if (load_path != nullptr) {
+    snapshot.restore(galaxy);
+    snapshot.close();
+    printf("loaded %d stars at step %ld from %s in %.1f ms\n", galaxy.num_stars(), galaxy.step_number, load_path, now_ms() - load_start);
+    report_overrides(scenario, galaxy, load_path);
+    if (scenario.deterministic && galaxy.theta_controller.mode == THETA_STEP_TIME) {
+      fprintf(stderr, "%s adapts theta to the step time, it cannot be deterministic\n", load_path);
+      return 1;
+    }
+    if (resume) {
+      num_steps = std::max(0L, num_steps - galaxy.step_number);
+    }
+  }
+  else {
+    generate_stars(galaxy, scenario);
+  }
+
+  TrajectoryWriter trajectory;
+  if (record_path != nullptr && !trajectory.open(record_path, galaxy.num_stars(), scenario.record_bits, scenario.keyframe_interval, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+
+  Checkpointer checkpointer;
+  if (checkpoint_path != nullptr) {
+    checkpointer.start(checkpoint_path, scenario.checkpoint_every, scenario.checkpoint_seconds);
+  }
+  double longest_stage = 0;
+
+  // changes before a loaded galaxy's step are set straight away, as it had them
+  long parameter_changes = 0;
+  double start = now_ms();
+  for (int step = 0; step < num_steps; step++) {
+    parameter_changes += scenario.timeline.apply(galaxy);
+    galaxy.step(dt);
+    if (trajectory.is_open()) {
+      trajectory.record(galaxy, dt);
+    }
+    double stage_start = now_ms();
+    if (checkpointer.after_step(galaxy)) {
+      longest_stage = std::max(longest_stage, now_ms() - stage_start);
+    }
+  }
+  double elapsed = now_ms() - start;
+  printf("%d stars, %d threads: %d steps in %.1f ms (%.2f ms/step)\n", galaxy.num_stars(), scheduler.num_workers(),
+         num_steps, elapsed, num_steps > 0 ? elapsed/num_steps : 0.0);
+  if (scenario.deterministic) {
+    printf("state hash %016llx at step %ld\n", (unsigned long long)galaxy.state_hash(), galaxy.step_number);
+  }
+  const ThetaController &controller = galaxy.theta_controller;
+  if (controller.mode != THETA_FIXED) {
+    printf("adaptive theta (%s): theta %.3f, step %.2f ms, force error %.2e, %.0f interactions per star\n",
+           theta_mode_names[controller.mode], galaxy.theta, controller.step_ms, controller.force_error, controller.interactions);
+  }
+  if (!scenario.timeline.changes.empty()) {
+    printf("set %ld of %d timeline parameter changes\n", parameter_changes, (int)scenario.timeline.changes.size());
+  }
+
+  if (checkpointer.is_running()) {
+    checkpointer.checkpoint(galaxy);
+    if (!checkpointer.finish(&error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    printf("wrote %ld checkpoints to %s, up to step %ld; longest step loop stall %.2f ms\n", (long)checkpointer.checkpoints_written,
+           checkpoint_path, (long)checkpointer.last_step_written, longest_stage);
+  }
+
+  if (trajectory.is_open()) {
+    if (!trajectory.close(&error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    long frames = trajectory.frames_written;
+    printf("recorded %ld frames (%ld dropped) to %s: %.1f MB, %.2f bytes/star/frame\n", frames, (long)trajectory.frames_dropped,
+           record_path, trajectory.bytes_written/1048576.0,
+           frames > 0 ? (double)trajectory.bytes_written/frames/galaxy.num_stars() : 0.0);
+  }
+
+  if (save_path != nullptr) {
+    double save_start = now_ms();
+    if (!save_snapshot(galaxy, save_path, &error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    printf("saved step %ld to %s in %.1f ms\n", galaxy.step_number, save_path, now_ms() - save_start);
+  }
+  return 0;
+}
+
+// steps before and during each timing of --autotune
+const int TUNING_WARMUP_STEPS = 2;
+const int TUNING_TIMED_STEPS = 5;
+// how much faster a setting has to be to replace the one before it, so noise
+// does not pick a different configuration every time
+const double TUNING_MARGIN = 0.02;
+
+int run_autotune(int argc, char* argv[]) {
+  Scenario scenario;
+  if (!read_scenario(argc, argv, &scenario, false)) {
+    return 1;
+  }
+  if (!two_dimensional(scenario, "--autotune")) {
+    return 1;
+  }
+  int num_stars = scenario.num_stars;
+  double dt = scenario.dt > 0 ? scenario.dt : HEADLESS_DT;
+  int max_threads = num_threads(scenario);
+  TaskScheduler scheduler(max_threads);
+
+  Galaxy galaxy(num_stars, WORLD_SIZE, WORLD_SIZE);
+  galaxy.scheduler = &scheduler;
+  generate_stars(galaxy, scenario);
+  galaxy.theta_controller.mode = THETA_FIXED;
+  std::vector<Point> initial_stars = galaxy.stars;
+
+  // every setting starts from the same stars; the median step is its time
+  std::vector<double> step_times(TUNING_TIMED_STEPS);
+  auto measure = [&](const TunedSettings &settings) {
+    scheduler.set_num_workers(settings.threads);
+    galaxy.leaf_capacity = settings.leaf_capacity;
+    galaxy.float_forces = settings.float_forces;
+    galaxy.resize(num_stars);
+    galaxy.stars = initial_stars;
+    galaxy.step_number = 0;
+    for (int step = 0; step < TUNING_WARMUP_STEPS; step++) {
+      galaxy.step(dt);
+    }
+    for (int step = 0; step < TUNING_TIMED_STEPS; step++) {
+      double start = now_ms();
+      galaxy.step(dt);
+      step_times[step] = now_ms() - start;
+    }
+    std::sort(step_times.begin(), step_times.end());
+    double ms = step_times[TUNING_TIMED_STEPS/2];
+    printf("%-8d %-14d %-8s %9.2f\n", settings.threads, settings.leaf_capacity, settings.float_forces ? "float" : "double", ms);
+    return ms;
+  };
+
+  // one setting at a time, keeping the best of each for the next
+  std::vector<int> thread_counts;
+  for (int threads = 1; threads < max_threads; threads *= 2) {
+    thread_counts.push_back(threads);
+  }
+  thread_counts.push_back(max_threads);
+  const int leaf_capacities[] = {1, 2, 4, 8, 16, 32};
+
+  printf("%d stars on %s, %d steps per setting\n\n", num_stars, host_name().c_str(), TUNING_WARMUP_STEPS + TUNING_TIMED_STEPS);
+  printf("%-8s %-14s %-8s %9s\n", "threads", "leaf capacity", "forces", "step ms");
+  TunedSettings best;
+  best.num_stars = num_stars;
+  best.threads = max_threads;
+  best.leaf_capacity = scenario.leaf_capacity;
+  best.float_forces = scenario.float_forces;
+  best.step_ms = measure(best);
+  auto try_settings = [&](const TunedSettings &settings) {
+    double ms = measure(settings);
+    if (ms < best.step_ms*(1 - TUNING_MARGIN)) {
+      best = settings;
+      best.step_ms = ms;
+    }
+  };
+  for (size_t i = 0; i < sizeof(leaf_capacities)/sizeof(leaf_capacities[0]); i++) {
+    TunedSettings settings = best;
+    settings.leaf_capacity = leaf_capacities[i];
+    if (settings.leaf_capacity != best.leaf_capacity) {
+      try_settings(settings);
+    }
+  }
+  TunedSettings other_kernel = best;
+  other_kernel.float_forces = !best.float_forces;
+  try_settings(other_kernel);
+  for (size_t i = 0; i < thread_counts.size(); i++) {
+    TunedSettings settings = best;
+    settings.threads = thread_counts[i];
+    if (settings.threads != best.threads) {
+      try_settings(settings);
+    }
+  }
+
+  std::string error;
+  if (!save_tuned_settings(TUNING_FILE, best, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  printf("\nbest: %d threads, leaf capacity %d, %s forces, %.2f ms/step; saved to %s\n", best.threads, best.leaf_capacity,
+         best.float_forces ? "float" : "double", best.step_ms, TUNING_FILE);
+  return 0;
+}
+
+int run_check_determinism(int argc, char* argv[]) {
+  Scenario scenario;
+  scenario.steps = 20;
+  scenario.deterministic = true;
+  if (!read_scenario(argc, argv, &scenario)) {
+    return 1;
+  }
+  if (!two_dimensional(scenario, "--check-determinism")) {
+    return 1;
+  }
+  int thread_counts[2] = {1, std::max(2, num_threads(scenario))};
+  uint64_t hashes[2];
+  double step_ms[2];
+  for (int run = 0; run < 2; run++) {
+    TaskScheduler scheduler(thread_counts[run]);
+    Galaxy galaxy(scenario.num_stars, WORLD_SIZE, WORLD_SIZE);
+    galaxy.scheduler = &scheduler;
+    generate_stars(galaxy, scenario);
+    double start = now_ms();
+    for (int step = 0; step < scenario.steps; step++) {
+      scenario.timeline.apply(galaxy);
+      galaxy.step(scenario.dt);
+    }
+    step_ms[run] = scenario.steps > 0 ? (now_ms() - start)/scenario.steps : 0.0;
+    hashes[run] = galaxy.state_hash();
+    scenario.timeline.rewind();
+    printf("%d threads: %d steps at %.2f ms/step, state hash %016llx\n", thread_counts[run], scenario.steps, step_ms[run],
+           (unsigned long long)hashes[run]);
+  }
+  if (hashes[0] != hashes[1]) {
+    printf("the runs differ\n");
+    return 1;
+  }
+  printf("identical on %d and %d threads\n", thread_counts[0], thread_counts[1]);
+  return 0;
+}
+
+// stars in each run of an ensemble unless told otherwise, as in the window
+const int ENSEMBLE_STARS = 5000;
+
+// what one run of an ensemble did
+struct EnsembleResult{
+  double ms;               // the whole run, start to finish
+  double first_energy;     // kinetic plus potential after the first step, exact
+  double kinetic;          // after the last
+  double potential;
+  double half_mass_radius; // around the center of mass
+  uint64_t state_hash;
+};
+
+int run_ensemble(int argc, char* argv[]) {
+  Scenario scenario;
+  scenario.num_stars = ENSEMBLE_STARS;
+  if (!read_scenario(argc, argv, &scenario)) {
+    return 1;
+  }
+  std::vector<std::string> labels;
+  std::vector<Scenario> members = scenario.ensemble_members(&labels);
+  int num_runs = (int)members.size();
+  for (int r = 0; r < num_runs; r++) {
+    if (!two_dimensional(members[r], "--ensemble")) {
+      return 1;
+    }
+  }
+  std::vector<EnsembleResult> results(num_runs);
+  TaskScheduler scheduler(num_threads(scenario));
+
+  // Every run is small and has a thread of its own; the pool hands runs to
+  // whichever worker is free, so a short run never holds up a core.
+  auto run_members = [&](int begin, int end) {
+    for (int r = begin; r < end; r++) {
+      Scenario &member = members[r];
+      EnsembleResult &result = results[r];
+      TaskScheduler serial(1);
+      Galaxy galaxy(member.num_stars, WORLD_SIZE, WORLD_SIZE);
+      galaxy.scheduler = &serial;
+      member.apply(galaxy);
+      double start = now_ms();
+      generate_initial_conditions(galaxy, member.conditions);
+      double dt = member.dt > 0 ? member.dt : HEADLESS_DT;
+      double kinetic = 0;
+      double potential = 0;
+      double energy_ms = 0; // the exact sums are not part of the run's time
+      std::vector<double> potentials;
+      for (int step = 0; step < member.steps; step++) {
+        member.timeline.apply(galaxy);
+        galaxy.step(dt);
+        if (step == 0) {
+          double energy_start = now_ms();
+          compute_total_energy(galaxy, potentials, &kinetic, &potential);
+          result.first_energy = kinetic + potential;
+          energy_ms = now_ms() - energy_start;
+        }
+      }
+      result.ms = now_ms() - start - energy_ms;
+      compute_total_energy(galaxy, potentials, &result.kinetic, &result.potential);
+
+      std::vector<double> distances(galaxy.num_stars());
+      for (int i = 0; i < galaxy.num_stars(); i++) {
+        double dx = galaxy.stars[i].x - galaxy.center_of_mass[0];
+        double dy = galaxy.stars[i].y - galaxy.center_of_mass[1];
+        distances[i] = std::sqrt(dx*dx + dy*dy);
+      }
+      std::nth_element(distances.begin(), distances.begin() + distances.size()/2, distances.end());
+      result.half_mass_radius = distances.empty() ? 0 : distances[distances.size()/2];
+      result.state_hash = galaxy.state_hash();
+    }
+  };
+  printf("%d runs of %d stars and %d steps on %d threads\n\n", num_runs, scenario.num_stars, scenario.steps, scheduler.num_workers());
+  double start = now_ms();
+  scheduler.parallel_for(0, num_runs, 1, run_members);
+  double elapsed = now_ms() - start;
+
+  FILE *summary = nullptr;
+  if (!scenario.summary_path.empty() && (summary = fopen(scenario.summary_path.c_str(), "w")) == nullptr) {
+    fprintf(stderr, "could not create %s\n", scenario.summary_path.c_str());
+    return 1;
+  }
+  if (summary != nullptr) {
+    fprintf(summary, "run,settings,stars,steps,ms_per_step,star_steps_per_s,kinetic,potential,energy_change,half_mass_radius,state_hash\n");
+  }
+  printf("%-4s %-36s %9s %12s %11s %11s %9s %9s %-16s\n", "run", "settings", "ms/step", "Mstar-st/s", "kinetic", "potential",
+         "energy", "r_half", "state hash");
+  double star_steps = 0;
+  for (int r = 0; r < num_runs; r++) {
+    const Scenario &member = members[r];
+    const EnsembleResult &result = results[r];
+    double steps = std::max(1, member.steps);
+    double energy = result.kinetic + result.potential;
+    double energy_change = result.first_energy != 0 ? (energy - result.first_energy)/std::fabs(result.first_energy) : 0;
+    double rate = (double)member.num_stars*member.steps/std::max(result.ms, 1e-9)*1000;
+    star_steps += (double)member.num_stars*member.steps;
+    const char *label = labels[r].empty() ? "(scenario)" : labels[r].c_str();
+    printf("%-4d %-36s %9.3f %12.2f %11.4g %11.4g %+8.2f%% %9.2f %016llx\n", r, label, result.ms/steps, rate/1e6, result.kinetic,
+           result.potential, 100*energy_change, result.half_mass_radius, (unsigned long long)result.state_hash);
+    if (summary != nullptr) {
+      fprintf(summary, "%d,%s,%d,%d,%.4f,%.0f,%.9g,%.9g,%.6g,%.6g,%016llx\n", r, label, member.num_stars, member.steps, result.ms/steps,
+              rate, result.kinetic, result.potential, energy_change, result.half_mass_radius, (unsigned long long)result.state_hash);
+    }
+  }
+  printf("\n%d runs in %.1f ms: %.2f runs/s, %.2f million star-steps/s\n", num_runs, elapsed, num_runs/(elapsed/1000),
+         star_steps/(elapsed/1000)/1e6);
+  if (summary != nullptr) {
+    bool ok = !ferror(summary);
+    if (fclose(summary) != 0 || !ok) {
+      fprintf(stderr, "could not write %s\n", scenario.summary_path.c_str());
+      return 1;
+    }
+    printf("summary written to %s\n", scenario.summary_path.c_str());
+  }
+  return 0;
+}
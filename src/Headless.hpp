@@ -0,0 +1,63 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+// Runs without opening a window, for measuring the simulation itself.
+// Every mode starts from a generated galaxy: --model NAME (see
+// galaxy_model_names), --radius R, --galaxies N and --seed S. All settings
+// can come from a --scenario FILE (see Scenario.hpp); options given on the
+// command line, including --theta and --dt, override the file. A scenario's
+// [timeline] changes the physics at given steps, as recorded from the GUI
+// with Save Session. --solver barnes-hut|direct picks how forces are
+// computed (see ForceSolver.hpp). --adaptive-theta step-time|force-error
+// adjusts theta after every step to hold --target-ms or --target-error (see
+// ThetaController.hpp). --leaf-capacity N lets tree leaves hold up to N
+// stars.
+
+// --headless [--stars N] [--seed S] [--threads N] [--steps N] [--load FILE] [--save FILE]
+//            [--record FILE] [--record-bits N] [--keyframe-interval N]
+//            [--checkpoint FILE] [--checkpoint-every N] [--checkpoint-seconds T] [--resume]
+// Simulates a galaxy, either a fresh disk or one loaded from a snapshot,
+// for a number of fixed time steps and reports the step time, optionally
+// recording every step as a trajectory and saving the final state as a
+// snapshot. With --checkpoint the state is also saved in the background
+// every N steps (500 by default) or T seconds; --resume continues from that
+// checkpoint, if there is one, until the galaxy reaches --steps in total.
+int run_headless(int argc, char* argv[]);
+
+// --accuracy [--stars N] [--seed S] [--threads N]
+// Compares the Barnes-Hut forces against exact summation for a range of
+// theta values in double and single precision, reporting error and speed,
+// then the shape of the tree and the walk's counters for each theta.
+int run_accuracy(int argc, char* argv[]);
+
+// --check-allocs [--stars N] [--seed S] [--threads N] [--warmup N] [--steps N]
+// Runs the frame's simulation work and fails (exit code 1) if any step after
+// the warmup allocates from the heap. Needs a build with allocation
+// tracking (make profile), exits with 2 otherwise.
+int run_check_allocs(int argc, char* argv[]);
+// --check-determinism [--stars N] [--threads N] [--steps N] [--scenario FILE]
+// Runs the same galaxy on one thread and on N (all cores by default) and
+// fails (exit code 1) unless both end in the same state, bit for bit. Runs
+// are deterministic by construction, so there is no slower deterministic
+// variant of the step: --deterministic (or deterministic = true in a
+// scenario) only refuses the settings that are not, such as a step-time
+// adaptive theta or a leaf capacity and kernel picked by --autotune, and
+// prints the final state hash of a headless run for comparisons.
+int run_check_determinism(int argc, char* argv[]);
+
+// --ensemble [--scenario FILE] [--threads N] [--summary FILE]
+// Runs the scenario once for every combination of the values in its
+// [ensemble] section, 5000 stars each unless it says otherwise, many at a
+// time with one thread each, and prints a table of each run's step time,
+// throughput, exact energies, change in total energy, half-mass radius and
+// state hash, also written as CSV to --summary. Outputs of the runs themselves
+// (save, record, checkpoint) are not written.
+int run_ensemble(int argc, char* argv[]);
+
+// --autotune [--stars N] [--threads MAX] [--scenario FILE]
+// Times a few steps of the run's galaxy for each leaf capacity, force
+// kernel (double or float) and thread count, one setting at a time, and
+// files the fastest under this host in starswift.tune. Later runs of about
+// the same size (within a factor of two) start from it, the GUI too, unless
+// given --untuned, a scenario with tuned = false, or settings of their own.
+int run_autotune(int argc, char* argv[]);
+#endif
@@ -0,0 +1,341 @@
+#include "InitialConditions.hpp"
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+const char *galaxy_model_names[MODEL_COUNT] = {"uniform-disk", "exponential-disk", "plummer", "hernquist", "collision"};
+
+const double PI = 3.14159265358979323846;
+// no star is placed further than this many radii from its galaxy's center
+const double MAX_RADII = 4;
+// resolution of the enclosed star counts the circular speeds come from
+const int RADIAL_BINS = 1024;
+// how far off the center colliding galaxies are aimed, in radians
+const double IMPACT_ANGLE = 0.3;
+// 3D: scale height of disks in radii, and how far colliding disks lean out
+// of the plane, in radians
+const double DISK_HEIGHT = 0.05;
+const double COLLISION_TILT = 0.5;
+
+int find_galaxy_model(const char *name) {
+  for (int model = 0; model < MODEL_COUNT; model++) {
+    if (strcmp(name, galaxy_model_names[model]) == 0) {
+      return model;
+    }
+  }
+  return -1;
+}
+
+InitialConditions::InitialConditions() {
+  model = MODEL_UNIFORM_DISK;
+  seed = 1;
+  center_x = 0;
+  center_y = 0;
+  center_z = 0;
+  radius = 100;
+  velocity_scale = 1;
+  num_galaxies = 2;
+  separation = 250;
+  approach_speed = 20;
+}
+
+// SplitMix64's finalizer
+static inline uint64_t mix(uint64_t z) {
+  z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// Uniform in (0, 1), a pure function of the seed, star and draw: a counter
+// based generator, so threads need no streams of their own to stay in step.
+static inline double uniform(uint64_t seed, int id, int draw) {
+  uint64_t counter = (uint64_t)id*8 + draw;
+  uint64_t bits = mix(mix(seed) + counter*0x9e3779b97f4a7c15ULL);
+  return ((bits >> 11) + 0.5)*(1.0/9007199254740992.0);
+}
+
+static bool is_disk(int model) {
+  return model == MODEL_UNIFORM_DISK || model == MODEL_EXPONENTIAL_DISK || model == MODEL_COLLISION;
+}
+
+// distance from the center of a galaxy of the given model, in its plane for
+// disks and in 3D for spheres, before clamping
+static double sample_distance(int model, double radius, uint64_t seed, int id) {
+  double u = uniform(seed, id, 0);
+  switch (model) {
+    case MODEL_UNIFORM_DISK:
+      return radius*std::sqrt(u);
+    case MODEL_EXPONENTIAL_DISK:
+    case MODEL_COLLISION:
+      // r*exp(-r/h) is a gamma distribution, the sum of two exponentials
+      return -radius/4*std::log(u*uniform(seed, id, 2));
+    case MODEL_PLUMMER:
+      return radius/3/std::sqrt(std::pow(u, -2.0/3) - 1);
+    case MODEL_HERNQUIST:
+      return radius/5*std::sqrt(u)/(1 - std::sqrt(u));
+  }
+  return 0;
+}
+
+// distance from the center of a galaxy of the given model, spheres looked at
+// from above
+static double sample_radius(int model, double radius, uint64_t seed, int id) {
+  double r = sample_distance(model, radius, seed, id);
+  if (!is_disk(model)) {
+    double cos_theta = 2*uniform(seed, id, 2) - 1;
+    r = r*std::sqrt(1 - cos_theta*cos_theta);
+  }
+  return std::min(r, MAX_RADII*radius);
+}
+
+// where each galaxy of a collision starts and how it moves, spaced evenly
+// around the center in its plane
+struct GalaxyOrbit{
+  double x;
+  double y;
+  double vx;
+  double vy;
+  double angle; // of its position around the center
+};
+
+static std::vector<GalaxyOrbit> plan_orbits(const InitialConditions &conditions, int num_galaxies) {
+  std::vector<GalaxyOrbit> orbits(num_galaxies);
+  for (int g = 0; g < num_galaxies; g++) {
+    double angle = 2*PI*g/num_galaxies;
+    double distance = num_galaxies > 1 ? conditions.separation : 0;
+    double speed = num_galaxies > 1 ? conditions.approach_speed : 0;
+    orbits[g].x = conditions.center_x + distance*std::cos(angle);
+    orbits[g].y = conditions.center_y + distance*std::sin(angle);
+    orbits[g].vx = -speed*std::cos(angle + IMPACT_ANGLE);
+    orbits[g].vy = -speed*std::sin(angle + IMPACT_ANGLE);
+    orbits[g].angle = angle;
+  }
+  return orbits;
+}
+
+static int galaxy_count(const InitialConditions &conditions, int num_stars) {
+  return conditions.model == MODEL_COLLISION ? std::max(1, std::min(conditions.num_galaxies, num_stars)) : 1;
+}
+
+// Stars inside each distance from their galaxy's center, binned.
+struct EnclosedStars{
+  int num_galaxies;
+  double bin_width;
+  std::vector<double> bin_counts;
+  std::vector<double> inside; // stars in the bins before
+
+  // Counts per chunk and then sums, which comes out the same however the
+  // chunks are shared out. distance_of(id) is star id's distance from the
+  // center of galaxy galaxy_of(id).
+  template <typename GalaxyOf, typename DistanceOf>
+  void count(int n, int num_galaxies, double radius, TaskScheduler &scheduler, GalaxyOf galaxy_of, DistanceOf distance_of) {
+    this->num_galaxies = num_galaxies;
+    const int max_chunks = 64;
+    int chunk = std::max(4096, (n + max_chunks - 1)/max_chunks);
+    int num_chunks = (n + chunk - 1)/chunk;
+    int bins_per_chunk = num_galaxies*RADIAL_BINS;
+    bin_width = MAX_RADII*radius/RADIAL_BINS;
+    std::vector<int> chunk_counts((size_t)num_chunks*bins_per_chunk, 0);
+    auto count_stars = [&](int begin, int end) {
+      for (int c = begin; c < end; c++) {
+        int *counts = &chunk_counts[(size_t)c*bins_per_chunk];
+        for (int id = c*chunk; id < std::min((c + 1)*chunk, n); id++) {
+          int bin = std::min(RADIAL_BINS - 1, (int)(distance_of(id)/bin_width));
+          counts[galaxy_of(id)*RADIAL_BINS + bin]++;
+        }
+      }
+    };
+    scheduler.parallel_for(0, num_chunks, 1, count_stars);
+    bin_counts.assign(bins_per_chunk, 0);
+    inside.assign(bins_per_chunk, 0);
+    for (int c = 0; c < num_chunks; c++) {
+      for (int b = 0; b < bins_per_chunk; b++) {
+        bin_counts[b] += chunk_counts[(size_t)c*bins_per_chunk + b];
+      }
+    }
+    for (int g = 0; g < num_galaxies; g++) {
+      for (int b = 1; b < RADIAL_BINS; b++) {
+        int i = g*RADIAL_BINS + b;
+        inside[i] = inside[i - 1] + bin_counts[i - 1];
+      }
+    }
+  }
+
+  // stars of galaxy g within r, interpolated inside r's bin
+  double within(int g, double r) const {
+    double position = std::min(r/bin_width, (double)RADIAL_BINS - 1);
+    int bin = (int)position;
+    return inside[g*RADIAL_BINS + bin] + (position - bin)*bin_counts[g*RADIAL_BINS + bin];
+  }
+};
+
+void generate_initial_conditions(Galaxy &galaxy, const InitialConditions &conditions) {
+  int n = galaxy.num_stars();
+  galaxy.resize(n); // ids back in slot order
+  galaxy.step_number = 0;
+  if (n == 0) {
+    return;
+  }
+  int model = conditions.model;
+  uint64_t seed = conditions.seed;
+  double radius = conditions.radius;
+  bool disk = is_disk(model);
+
+  // galaxies, each with a contiguous range of ids
+  int num_galaxies = galaxy_count(conditions, n);
+  std::vector<GalaxyOrbit> orbits = plan_orbits(conditions, num_galaxies);
+  auto galaxy_of = [&](int id) {
+    return (int)((int64_t)id*num_galaxies/n);
+  };
+
+  // positions relative to their galaxy's center
+  auto place_stars = [&](int begin, int end) {
+    for (int id = begin; id < end; id++) {
+      double r = sample_radius(model, radius, seed, id);
+      double angle = 2*PI*uniform(seed, id, 1);
+      galaxy.stars[id] = Point(r*std::cos(angle), r*std::sin(angle), 0, 0, 0, 0);
+    }
+  };
+  galaxy.scheduler->parallel_for(0, n, 4096, place_stars);
+
+  EnclosedStars enclosed;
+  auto distance_of = [&](int id) {
+    const Point &p = galaxy.stars[id];
+    return std::sqrt(p.x*p.x + p.y*p.y);
+  };
+  enclosed.count(n, num_galaxies, radius, *galaxy.scheduler, galaxy_of, distance_of);
+
+  // circular speed of the stars within r, pulled by the same softened
+  // gravity as the force walk
+  double gravity = galaxy.gravity_strength;
+  double softening = std::pow(10, galaxy.soft_power);
+  double softening_squared = softening*softening;
+  auto set_velocities = [&](int begin, int end) {
+    for (int id = begin; id < end; id++) {
+      Point &p = galaxy.stars[id];
+      int g = galaxy_of(id);
+      double r = std::sqrt(p.x*p.x + p.y*p.y);
+      double speed = conditions.velocity_scale*std::sqrt(gravity*enclosed.within(g, r)*r/(r*r + softening_squared));
+      double vx, vy;
+      if (disk) {
+        vx = r > 0 ? -speed*p.y/r : 0;
+        vy = r > 0 ? speed*p.x/r : 0;
+      }
+      else {
+        // random directions, the same speed on average
+        double sigma = speed/std::sqrt(2.0);
+        double amplitude = sigma*std::sqrt(-2*std::log(uniform(seed, id, 3)));
+        double angle = 2*PI*uniform(seed, id, 4);
+        vx = amplitude*std::cos(angle);
+        vy = amplitude*std::sin(angle);
+      }
+      p = Point(orbits[g].x + p.x, orbits[g].y + p.y, orbits[g].vx + vx, orbits[g].vy + vy, 0, 0);
+    }
+  };
+  galaxy.scheduler->parallel_for(0, n, 4096, set_velocities);
+}
+
+// Turns v by `angle` about the horizontal unit axis (kx, ky, 0).
+static void tilt(double *v, double kx, double ky, double angle) {
+  double c = std::cos(angle);
+  double s = std::sin(angle);
+  double along = (kx*v[0] + ky*v[1])*(1 - c);
+  double cross[3] = {ky*v[2], -kx*v[2], kx*v[1] - ky*v[0]};
+  v[0] = v[0]*c + cross[0]*s + kx*along;
+  v[1] = v[1]*c + cross[1]*s + ky*along;
+  v[2] = v[2]*c + cross[2]*s;
+}
+
+void generate_initial_conditions(Galaxy3D &galaxy, const InitialConditions &conditions) {
+  int n = galaxy.num_stars();
+  galaxy.step_number = 0;
+  if (n == 0) {
+    return;
+  }
+  int model = conditions.model;
+  uint64_t seed = conditions.seed;
+  double radius = conditions.radius;
+  bool disk = is_disk(model);
+
+  int num_galaxies = galaxy_count(conditions, n);
+  std::vector<GalaxyOrbit> orbits = plan_orbits(conditions, num_galaxies);
+  auto galaxy_of = [&](int id) {
+    return (int)((int64_t)id*num_galaxies/n);
+  };
+
+  // positions relative to their galaxy's center, before any tilt
+  auto place_stars = [&](int begin, int end) {
+    for (int id = begin; id < end; id++) {
+      Galaxy3D::Star &s = galaxy.stars[id];
+      double angle = 2*PI*uniform(seed, id, 1);
+      if (disk) {
+        double r = sample_radius(model, radius, seed, id);
+        // the inverse of the sech^2 profile's cumulative distribution
+        double height = DISK_HEIGHT*radius*std::atanh(2*uniform(seed, id, 5) - 1);
+        s.position[0] = r*std::cos(angle);
+        s.position[1] = r*std::sin(angle);
+        s.position[2] = height;
+      }
+      else {
+        double r = std::min(sample_distance(model, radius, seed, id), MAX_RADII*radius);
+        double cos_theta = 2*uniform(seed, id, 2) - 1;
+        double sin_theta = std::sqrt(1 - cos_theta*cos_theta);
+        s.position[0] = r*sin_theta*std::cos(angle);
+        s.position[1] = r*sin_theta*std::sin(angle);
+        s.position[2] = r*cos_theta;
+      }
+    }
+  };
+  galaxy.scheduler->parallel_for(0, n, 4096, place_stars);
+
+  // disks orbit the mass inside their cylinder, spheres inside their sphere
+  EnclosedStars enclosed;
+  auto distance_of = [&](int id) {
+    const double *x = galaxy.stars[id].position;
+    return std::sqrt(x[0]*x[0] + x[1]*x[1] + (disk ? 0 : x[2]*x[2]));
+  };
+  enclosed.count(n, num_galaxies, radius, *galaxy.scheduler, galaxy_of, distance_of);
+
+  double gravity = galaxy.gravity_strength;
+  double softening = std::pow(10, galaxy.soft_power);
+  double softening_squared = softening*softening;
+  auto set_velocities = [&](int begin, int end) {
+    for (int id = begin; id < end; id++) {
+      Galaxy3D::Star &s = galaxy.stars[id];
+      double *x = s.position;
+      double *v = s.velocity;
+      int g = galaxy_of(id);
+      double r = distance_of(id);
+      double speed = conditions.velocity_scale*std::sqrt(gravity*enclosed.within(g, r)*r/(r*r + softening_squared));
+      if (disk) {
+        v[0] = r > 0 ? -speed*x[1]/r : 0;
+        v[1] = r > 0 ? speed*x[0]/r : 0;
+        v[2] = 0;
+      }
+      else {
+        // random directions, the same speed on average
+        double sigma = speed/std::sqrt(3.0);
+        double amplitude = sigma*std::sqrt(-2*std::log(uniform(seed, id, 3)));
+        double angle = 2*PI*uniform(seed, id, 4);
+        v[0] = amplitude*std::cos(angle);
+        v[1] = amplitude*std::sin(angle);
+        v[2] = sigma*std::sqrt(-2*std::log(uniform(seed, id, 5)))*std::cos(2*PI*uniform(seed, id, 6));
+      }
+      // colliding disks lean about the line to the center, alternately each way
+      if (num_galaxies > 1) {
+        double lean = g % 2 == 0 ? COLLISION_TILT : -COLLISION_TILT;
+        tilt(x, std::cos(orbits[g].angle), std::sin(orbits[g].angle), lean);
+        tilt(v, std::cos(orbits[g].angle), std::sin(orbits[g].angle), lean);
+      }
+      x[0] += orbits[g].x;
+      x[1] += orbits[g].y;
+      x[2] += conditions.center_z;
+      v[0] += orbits[g].vx;
+      v[1] += orbits[g].vy;
+      for (int axis = 0; axis < 3; axis++) {
+        s.acceleration[axis] = 0;
+      }
+    }
+  };
+  galaxy.scheduler->parallel_for(0, n, 4096, set_velocities);
+}
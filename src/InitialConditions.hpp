@@ -0,0 +1,48 @@
+#ifndef INITIAL_CONDITIONS_H
+#define INITIAL_CONDITIONS_H
+#include <stdint.h>
+#include "Galaxy.hpp"
+
+enum GalaxyModel {
+  MODEL_UNIFORM_DISK,     // stars spread evenly over a disk of the radius
+  MODEL_EXPONENTIAL_DISK, // surface density falling off as exp(-r/h), h = radius/4
+  MODEL_PLUMMER,          // Plummer sphere (seen from above in 2D), scale radius radius/3
+  MODEL_HERNQUIST,        // Hernquist sphere (seen from above in 2D), scale radius radius/5
+  MODEL_COLLISION,        // exponential disks falling towards each other
+  MODEL_COUNT
+};
+
+extern const char *galaxy_model_names[MODEL_COUNT];
+// the model called `name` (as in galaxy_model_names), -1 if there is none
+int find_galaxy_model(const char *name);
+
+struct InitialConditions{
+  int model;
+  uint64_t seed;
+  double center_x;
+  double center_y;
+  double center_z;       // 3D only
+  double radius;         // of each galaxy, most of its stars fall inside
+  double velocity_scale; // of the equilibrium speeds, below 1 collapses, above 1 flies apart
+
+  // collisions
+  int num_galaxies;      // spaced evenly around the center
+  double separation;     // distance of each galaxy from the center
+  double approach_speed; // towards the center, aimed off it so they swing past
+
+  InitialConditions();
+};
+
+// Replaces every star with a sample of the model, in id order, and resets
+// the step number. Disks rotate at the circular speed of the stars inside
+// them under the galaxy's gravity and softening, spheres get random motions
+// of the same size. Every random number is a hash of the seed, the star's id
+// and the draw, so the stars come out the same bit for bit whatever the
+// number of threads.
+void generate_initial_conditions(Galaxy &galaxy, const InitialConditions &conditions);
+// The same in 3D: disks are thin (a sech^2 profile of height radius/20)
+// around the z = center_z plane, colliding ones each tilted about the line
+// to the center, and spheres fill all three dimensions with random motions
+// in every direction.
+void generate_initial_conditions(Galaxy3D &galaxy, const InitialConditions &conditions);
+#endif
@@ -0,0 +1,241 @@
+#include "Playback.hpp"
+#include <algorithm>
+
+TrajectoryPlayer::TrajectoryPlayer() {
+  for (int s = 0; s < SLOTS; s++) {
+    states[s] = SLOT_FREE;
+  }
+  next_frame = 0;
+  target = 0;
+  stride = 1;
+  generation = 0;
+  closing = false;
+  last_decoded = -1;
+}
+
+TrajectoryPlayer::~TrajectoryPlayer() {
+  close();
+}
+
+bool TrajectoryPlayer::open(const char *path, std::string *error) {
+  close();
+  if (!reader.open(path, error)) {
+    return false;
+  }
+  int n = reader.num_stars();
+  for (int s = 0; s < SLOTS; s++) {
+    frames[s].index = -1;
+    frames[s].stars.resize(n);
+    states[s] = SLOT_FREE;
+  }
+  for (int h = 0; h < 3; h++) {
+    history_x[h].resize(n);
+    history_y[h].resize(n);
+    history_index[h] = -1;
+  }
+  last_decoded = -1;
+  next_frame = 0;
+  target = 0;
+  stride = 1;
+  closing = false;
+  thread = std::thread(&TrajectoryPlayer::decoder_loop, this);
+  return true;
+}
+
+void TrajectoryPlayer::close() {
+  if (!thread.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closing = true;
+  }
+  work.notify_one();
+  thread.join();
+  reader.close();
+}
+
+bool TrajectoryPlayer::is_open() const {
+  return thread.joinable();
+}
+
+int TrajectoryPlayer::num_frames() const {
+  return reader.num_frames();
+}
+
+int TrajectoryPlayer::num_stars() const {
+  return reader.num_stars();
+}
+
+double TrajectoryPlayer::duration() const {
+  int n = reader.num_frames();
+  return n > 1 ? reader.frame(n - 1).time - reader.frame(0).time : 0;
+}
+
+TrajectoryPlayer::Frame *TrajectoryPlayer::show(int index) {
+  if (!is_open() || reader.num_frames() == 0) {
+    return nullptr;
+  }
+  index = std::min(std::max(index, 0), reader.num_frames() - 1);
+  std::lock_guard<std::mutex> lock(mutex);
+  int shown = -1;
+  int newest = -1; // the latest decoded frame not past the one asked for
+  for (int s = 0; s < SLOTS; s++) {
+    if (states[s] == SLOT_SHOWN) {
+      shown = s;
+    }
+    if (states[s] == SLOT_READY && frames[s].index <= index && (newest < 0 || frames[s].index > frames[newest].index)) {
+      newest = s;
+    }
+  }
+  if (newest >= 0 && (shown < 0 || frames[shown].index > index || frames[newest].index > frames[shown].index)) {
+    if (shown >= 0) {
+      states[shown] = SLOT_FREE;
+    }
+    states[newest] = SLOT_SHOWN;
+    shown = newest;
+  }
+
+  // frames behind the one asked for will not be shown any more. If the
+  // decoder is not heading for it, start it over from there; a frame just
+  // past it will do while playing, but not once playback stops there.
+  bool coming = shown >= 0 && frames[shown].index == index;
+  bool near = false;
+  for (int s = 0; s < SLOTS; s++) {
+    if (states[s] == SLOT_READY && frames[s].index < index) {
+      states[s] = SLOT_FREE;
+    }
+    if (states[s] == SLOT_READY || states[s] == SLOT_DECODING) {
+      coming = coming || frames[s].index <= index;
+      near = near || (frames[s].index > index && frames[s].index <= index + stride);
+    }
+  }
+  coming = coming || next_frame <= index;
+  near = near && index != target && (shown < 0 || frames[shown].index <= index);
+  if (!coming && !near) {
+    for (int s = 0; s < SLOTS; s++) {
+      if (states[s] == SLOT_READY) {
+        states[s] = SLOT_FREE;
+      }
+    }
+    generation++;
+    next_frame = index;
+  }
+  // decode ahead at the rate frames are being asked for, a long jump is a
+  // seek rather than a playback speed
+  if (index > target) {
+    stride = index - target <= MAX_STRIDE ? index - target : 1;
+  }
+  target = index;
+  work.notify_one();
+  return shown >= 0 ? &frames[shown] : nullptr;
+}
+
+void TrajectoryPlayer::update_colors(Frame &frame, double max_distance, double max_speed, double galaxy_r, double galaxy_g, double galaxy_b,
+                                     int color_mode, TaskScheduler &scheduler) {
+  auto color_stars = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      frame.stars[i].update_star_color(frame.center_x, frame.center_y, max_distance, max_speed, galaxy_r, galaxy_g, galaxy_b, color_mode);
+    }
+  };
+  scheduler.parallel_for(0, (int)frame.stars.size(), 4096, color_stars);
+}
+
+void TrajectoryPlayer::decoder_loop() {
+  while (true) {
+    int s = -1;
+    int index;
+    int decode_generation;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (!closing) {
+        s = -1;
+        for (int i = 0; i < SLOTS && s < 0; i++) {
+          if (states[i] == SLOT_FREE) {
+            s = i;
+          }
+        }
+        index = std::max(next_frame, target);
+        if (s >= 0 && index < reader.num_frames()) {
+          break;
+        }
+        work.wait(lock);
+      }
+      if (closing) {
+        return;
+      }
+      states[s] = SLOT_DECODING;
+      frames[s].index = index;
+      decode_generation = generation;
+      next_frame = index + stride;
+    }
+
+    fill_frame(index, frames[s]);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      states[s] = decode_generation == generation ? SLOT_READY : SLOT_FREE;
+    }
+  }
+}
+
+// Leaves the positions of `index` and, where they exist, the two frames
+// before it in the history, taking whichever is shorter: decoding on from
+// the last frame or starting over from a keyframe.
+void TrajectoryPlayer::decode_positions(int index) {
+  int restart = std::max(0, index - 2);
+  int restart_cost = index - reader.keyframe_before(restart) + 1;
+  bool follow_on = last_decoded >= 0 && last_decoded < index && index - last_decoded <= restart_cost;
+  int start = follow_on ? last_decoded + 1 : restart;
+  for (int f = std::max(start, index - 2); f <= index; f++) {
+    history_index[f % 3] = -1;
+  }
+  for (int f = start; f <= index; f++) {
+    reader.read_frame(f, history_x[f % 3].data(), history_y[f % 3].data());
+    history_index[f % 3] = f;
+  }
+  last_decoded = index;
+}
+
+void TrajectoryPlayer::fill_frame(int index, Frame &frame) {
+  decode_positions(index);
+  const TrajectoryFrameHeader &header = reader.frame(index);
+  frame.step_number = header.step_number;
+  frame.time = header.time;
+
+  // velocity over the step into this frame, acceleration from the change
+  // since the step before
+  int previous = index - 1;
+  int second = index - 2;
+  bool have_previous = previous >= 0 && history_index[previous % 3] == previous;
+  bool have_second = have_previous && second >= 0 && history_index[second % 3] == second;
+  double dt = have_previous ? header.time - reader.frame(previous).time : 0;
+  double previous_dt = have_second ? reader.frame(previous).time - reader.frame(second).time : 0;
+  double inverse_dt = dt > 0 ? 1/dt : 0;
+  double inverse_previous_dt = previous_dt > 0 ? 1/previous_dt : 0;
+
+  const double *x = history_x[index % 3].data();
+  const double *y = history_y[index % 3].data();
+  const double *px = have_previous ? history_x[previous % 3].data() : x;
+  const double *py = have_previous ? history_y[previous % 3].data() : y;
+  const double *ppx = have_second ? history_x[second % 3].data() : px;
+  const double *ppy = have_second ? history_y[second % 3].data() : py;
+  int n = (int)frame.stars.size();
+  double sum_x = 0;
+  double sum_y = 0;
+  for (int i = 0; i < n; i++) {
+    Point &p = frame.stars[i];
+    p.x = x[i];
+    p.y = y[i];
+    p.vx = (x[i] - px[i])*inverse_dt;
+    p.vy = (y[i] - py[i])*inverse_dt;
+    double previous_vx = have_second ? (px[i] - ppx[i])*inverse_previous_dt : p.vx;
+    double previous_vy = have_second ? (py[i] - ppy[i])*inverse_previous_dt : p.vy;
+    p.ax = (p.vx - previous_vx)*inverse_dt;
+    p.ay = (p.vy - previous_vy)*inverse_dt;
+    sum_x += p.x;
+    sum_y += p.y;
+  }
+  frame.center_x = n > 0 ? sum_x/n : 0;
+  frame.center_y = n > 0 ? sum_y/n : 0;
+}
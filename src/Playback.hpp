@@ -0,0 +1,76 @@
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Point.hpp"
+#include "TaskScheduler.hpp"
+#include "Trajectory.hpp"
+
+// Plays a recorded trajectory back for display. A decoder thread runs ahead
+// of the frame being shown and turns frames into stars, with velocities and
+// accelerations differenced from the frames before them, so they can be
+// coloured and drawn like simulated ones.
+class TrajectoryPlayer{
+
+public:
+  static const int SLOTS = 4;
+  static const int MAX_STRIDE = 16; // frames skipped per shown frame when playing fast
+
+  struct Frame{
+    int index;
+    long step_number;
+    double time;
+    double center_x; // mean position, what the colour modes measure from
+    double center_y;
+    std::vector<Point> stars; // in star id order
+  };
+
+public:
+  TrajectoryPlayer();
+  ~TrajectoryPlayer();
+  bool open(const char *path, std::string *error);
+  void close();
+  bool is_open() const;
+  int num_frames() const;
+  int num_stars() const;
+  double duration() const; // simulated time from the first frame to the last
+  // Returns frame `index` if it has been decoded, otherwise keeps showing
+  // the frame returned last (nullptr before the first) while the decoder
+  // catches up, seeking when `index` is out of its way. The frame stays
+  // valid and may be modified until the next call.
+  Frame *show(int index);
+  void update_colors(Frame &frame, double max_distance, double max_speed, double galaxy_r, double galaxy_g, double galaxy_b,
+                     int color_mode, TaskScheduler &scheduler);
+
+private:
+  enum SlotState { SLOT_FREE, SLOT_DECODING, SLOT_READY, SLOT_SHOWN };
+
+  TrajectoryReader reader;
+  Frame frames[SLOTS];
+  SlotState states[SLOTS];
+  int next_frame; // where the decoder goes on from, unless target is further
+  int target;     // the frame show() asked for last, frames before it are skipped
+  int stride;     // how far show() moves per call while playing
+  int generation; // bumped by seeks, stale decodes are thrown away
+  bool closing;
+  std::mutex mutex;
+  std::condition_variable work;
+  std::thread thread;
+
+  // decoder thread only: the last three decoded frames' positions
+  std::vector<double> history_x[3];
+  std::vector<double> history_y[3];
+  int history_index[3];
+  int last_decoded;
+
+  void decoder_loop();
+  void decode_positions(int index);
+  void fill_frame(int index, Frame &frame);
+
+  TrajectoryPlayer(const TrajectoryPlayer &);
+  TrajectoryPlayer &operator=(const TrajectoryPlayer &);
+};
+#endif
@@ -1,3 +1,5 @@
+#ifndef POINT_H
+#define POINT_H
 class Point{
 public:
   Point();
@@ -13,3 +15,4 @@ public:
   float g;
   float b;
 };
+#endif
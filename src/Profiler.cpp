@@ -0,0 +1,76 @@
+#include "Profiler.hpp"
+#include <algorithm>
+#include <string.h>
+
+const char *Profiler::phase_names[PHASE_COUNT] = {
+  "Tree Build", "Force Walk", "Integration", "Coloring", "Energy", "Star Drawing", "ImGui", "Present"
+};
+
+Profiler::Profiler() {
+  memset(history, 0, sizeof(history));
+  memset(current, 0, sizeof(current));
+  num_frames = 0;
+}
+
+void Profiler::add(int phase, double ms) {
+  current[phase] += (float)ms;
+}
+
+void Profiler::start(int phase) {
+  started[phase] = std::chrono::steady_clock::now();
+}
+
+void Profiler::stop(int phase) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  add(phase, std::chrono::duration<double, std::milli>(now - started[phase]).count());
+  if (Tracer::enabled()) {
+    Tracer::record(phase_names[phase],
+                   std::chrono::duration_cast<std::chrono::nanoseconds>(started[phase].time_since_epoch()).count(),
+                   std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count());
+  }
+}
+
+void Profiler::end_frame() {
+  for (int phase = 0; phase < PHASE_COUNT; phase++) {
+    memmove(history[phase], history[phase] + 1, (HISTORY - 1)*sizeof(float));
+    history[phase][HISTORY - 1] = current[phase];
+    current[phase] = 0;
+  }
+  if (num_frames < HISTORY) {
+    num_frames++;
+  }
+}
+
+void Profiler::phase_stats(int phase, float *min, float *avg, float *p99) const {
+  if (num_frames == 0) {
+    *min = 0;
+    *avg = 0;
+    *p99 = 0;
+    return;
+  }
+  // the newest frames are at the end
+  float sorted[HISTORY];
+  memcpy(sorted, history[phase] + HISTORY - num_frames, num_frames*sizeof(float));
+  std::sort(sorted, sorted + num_frames);
+  float sum = 0;
+  for (int i = 0; i < num_frames; i++) {
+    sum += sorted[i];
+  }
+  *min = sorted[0];
+  *avg = sum/num_frames;
+  *p99 = sorted[(int)(num_frames*0.99)];
+}
+
+ScopedTimer::ScopedTimer(Profiler *profiler, int phase) : trace(Profiler::phase_names[phase]) {
+  this->profiler = profiler;
+  this->phase = phase;
+  if (profiler != nullptr) {
+    start = std::chrono::steady_clock::now();
+  }
+}
+
+ScopedTimer::~ScopedTimer() {
+  if (profiler != nullptr) {
+    profiler->add(phase, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+  }
+}
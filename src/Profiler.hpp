@@ -0,0 +1,58 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include <chrono>
+#include "Tracer.hpp"
+
+enum ProfilePhase {
+  PHASE_TREE_BUILD,
+  PHASE_FORCE_WALK,
+  PHASE_INTEGRATION,
+  PHASE_COLORING,
+  PHASE_ENERGY,
+  PHASE_DRAWING,
+  PHASE_IMGUI,
+  PHASE_PRESENT,
+  PHASE_COUNT
+};
+
+// Rolling per-phase frame timings. Phases add time to the current frame,
+// end_frame() moves it into the history.
+class Profiler{
+
+public:
+  static const int HISTORY = 300;
+  static const char *phase_names[PHASE_COUNT];
+
+  float history[PHASE_COUNT][HISTORY]; // ms, oldest first
+  float current[PHASE_COUNT];
+  int num_frames; // in the history so far, up to HISTORY
+
+public:
+  Profiler();
+  void add(int phase, double ms);
+  // for phases that do not fit a single scope
+  void start(int phase);
+  void stop(int phase);
+  void end_frame();
+  // over the recorded frames only, all zero before the first
+  void phase_stats(int phase, float *min, float *avg, float *p99) const;
+
+private:
+  std::chrono::steady_clock::time_point started[PHASE_COUNT];
+};
+
+// Adds the time between construction and destruction to a phase, and to the
+// trace while one is recording; a null profiler skips the frame timing.
+class ScopedTimer{
+
+public:
+  ScopedTimer(Profiler *profiler, int phase);
+  ~ScopedTimer();
+
+private:
+  Profiler *profiler;
+  int phase;
+  std::chrono::steady_clock::time_point start;
+  TraceScope trace;
+};
+#endif
@@ -0,0 +1,158 @@
+#include "RenderBuffer.hpp"
+#include <algorithm>
+#include <cmath>
+#include "helper.h"
+
+const double PI = 3.14159265358979323846;
+// radians turned per pixel dragged
+const double ROTATE_SPEED = 0.005;
+const double MAX_PITCH = PI/2 - 0.01;
+// distance kept per wheel step in
+const double ZOOM_STEP = 0.9;
+const uint32_t BLACK = 0xff000000;
+
+Camera::Camera() {
+  for (int axis = 0; axis < 3; axis++) {
+    target[axis] = 0;
+  }
+  yaw = 0;
+  pitch = PI/6;
+  distance = 1000;
+  field_of_view = PI/4;
+  screen_x = 0;
+  screen_y = 0;
+}
+
+void Camera::rotate(double dx, double dy) {
+  yaw -= dx*ROTATE_SPEED;
+  pitch = std::max(-MAX_PITCH, std::min(MAX_PITCH, pitch + dy*ROTATE_SPEED));
+}
+
+void Camera::zoom(double steps) {
+  distance *= std::pow(ZOOM_STEP, steps);
+}
+
+RenderBuffer::RenderBuffer() {
+  width = 0;
+  height = 0;
+}
+
+void RenderBuffer::resize(int width, int height) {
+  this->width = width;
+  this->height = height;
+  pixels.assign((size_t)width*height, BLACK);
+  depths.assign((size_t)width*height, INFINITY);
+}
+
+static inline uint32_t pack_color(double r, double g, double b) {
+  uint32_t red = (uint32_t)std::max(0.0, std::min(255.0, r));
+  uint32_t green = (uint32_t)std::max(0.0, std::min(255.0, g));
+  uint32_t blue = (uint32_t)std::max(0.0, std::min(255.0, b));
+  return BLACK | red << 16 | green << 8 | blue;
+}
+
+void RenderBuffer::draw(const Point *stars, int num_stars, TaskScheduler &scheduler) {
+  star_pixels.resize(num_stars);
+  star_colors.resize(num_stars);
+  auto place_stars = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      const Point &p = stars[i];
+      bool visible = p.x >= 0 && p.x < width && p.y >= 0 && p.y < height;
+      star_pixels[i] = visible ? (int)p.y*width + (int)p.x : -1;
+      star_colors[i] = pack_color(p.r, p.g, p.b);
+    }
+  };
+  scheduler.parallel_for(0, num_stars, 4096, place_stars);
+  fill(num_stars, false, scheduler);
+}
+
+void RenderBuffer::draw(const Octree::Body *stars, int num_stars, const Camera &camera, const StarColoring &coloring,
+                        TaskScheduler &scheduler) {
+  star_pixels.resize(num_stars);
+  star_colors.resize(num_stars);
+  star_depths.resize(num_stars);
+
+  // the camera's axes: forward towards the target, right level with the plane
+  double cos_pitch = std::cos(camera.pitch);
+  double sin_pitch = std::sin(camera.pitch);
+  double cos_yaw = std::cos(camera.yaw);
+  double sin_yaw = std::sin(camera.yaw);
+  double forward[3] = {-cos_pitch*sin_yaw, cos_pitch*cos_yaw, -sin_pitch};
+  double right[3] = {cos_yaw, sin_yaw, 0};
+  double up[3] = {-sin_yaw*sin_pitch, cos_yaw*sin_pitch, cos_pitch};
+  double eye[3];
+  for (int axis = 0; axis < 3; axis++) {
+    eye[axis] = camera.target[axis] - camera.distance*forward[axis];
+  }
+  double focal_length = height/2/std::tan(camera.field_of_view/2);
+  double near = 1e-3*camera.distance;
+
+  const double *base = coloring.color;
+  auto place_stars = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      const Octree::Body &s = stars[i];
+      double d[3] = {s.position[0] - eye[0], s.position[1] - eye[1], s.position[2] - eye[2]};
+      double depth = d[0]*forward[0] + d[1]*forward[1] + d[2]*forward[2];
+      star_pixels[i] = -1;
+      if (depth < near) {
+        continue;
+      }
+      double scale = focal_length/depth;
+      double x = camera.screen_x + scale*(d[0]*right[0] + d[1]*right[1]);
+      double y = camera.screen_y - scale*(d[0]*up[0] + d[1]*up[1] + d[2]*up[2]);
+      if (!(x >= 0 && x < width && y >= 0 && y < height)) {
+        continue;
+      }
+      star_pixels[i] = (int)y*width + (int)x;
+      star_depths[i] = (float)depth;
+
+      // how far towards white the star is, by distance or by speed
+      double lift = 0;
+      if (coloring.mode == 0) {
+        double dx = s.position[0] - coloring.center[0];
+        double dy = s.position[1] - coloring.center[1];
+        double dz = s.position[2] - coloring.center[2];
+        lift = convert_ranges(coloring.max_distance - std::sqrt(dx*dx + dy*dy + dz*dz), 0, coloring.max_distance, 0, 1);
+      }
+      else if (coloring.mode == 2) {
+        const double *v = s.velocity;
+        lift = convert_ranges(coloring.max_speed - std::sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]), 0, coloring.max_speed, 0, 1);
+      }
+      star_colors[i] = pack_color((base[0] + lift*(1 - base[0]))*255, (base[1] + lift*(1 - base[1]))*255,
+                                  (base[2] + lift*(1 - base[2]))*255);
+    }
+  };
+  scheduler.parallel_for(0, num_stars, 4096, place_stars);
+  fill(num_stars, true, scheduler);
+}
+
+// One band of rows per worker. Every band looks at every star but writes
+// only its own rows; with the depth test the nearest star wins, otherwise
+// the last one, as when stars were drawn one after another.
+void RenderBuffer::fill(int num_stars, bool depth_test, TaskScheduler &scheduler) {
+  int num_bands = std::max(1, std::min(height, scheduler.num_workers()));
+  auto fill_bands = [&](int begin, int end) {
+    for (int band = begin; band < end; band++) {
+      int first = (int)((int64_t)height*band/num_bands)*width;
+      int last = (int)((int64_t)height*(band + 1)/num_bands)*width;
+      std::fill(pixels.begin() + first, pixels.begin() + last, BLACK);
+      if (depth_test) {
+        std::fill(depths.begin() + first, depths.begin() + last, INFINITY);
+      }
+      for (int i = 0; i < num_stars; i++) {
+        int pixel = star_pixels[i];
+        if (pixel < first || pixel >= last) {
+          continue;
+        }
+        if (!depth_test) {
+          pixels[pixel] = star_colors[i];
+        }
+        else if (star_depths[i] < depths[pixel]) {
+          pixels[pixel] = star_colors[i];
+          depths[pixel] = star_depths[i];
+        }
+      }
+    }
+  };
+  scheduler.parallel_for(0, num_bands, 1, fill_bands);
+}
@@ -0,0 +1,62 @@
+#ifndef RENDER_BUFFER_H
+#define RENDER_BUFFER_H
+#include <stdint.h>
+#include <vector>
+#include "Point.hpp"
+#include "SpatialTree.hpp"
+
+// Where the 3D view looks from. It circles `target` at `distance`, turned
+// `yaw` about the vertical (z) axis and raised `pitch` above the plane.
+struct Camera{
+  double target[3];
+  double yaw;           // radians
+  double pitch;         // radians, short of straight up or down
+  double distance;
+  double field_of_view; // vertical, radians
+  double screen_x;      // where the target is drawn
+  double screen_y;
+
+  Camera();
+  // by a mouse drag of dx, dy pixels
+  void rotate(double dx, double dy);
+  // by mouse wheel steps, positive moves in
+  void zoom(double steps);
+};
+
+// How 3D stars are coloured, the same modes as Point::update_star_color.
+struct StarColoring{
+  int mode;            // 0 radial, 1 solid, 2 velocity
+  double center[3];    // radial: brightest here
+  double max_distance; // radial: down to the galaxy colour this far out
+  double max_speed;    // velocity: down to the galaxy colour at this speed
+  double color[3];     // the galaxy colour, 0 to 1
+};
+
+// The stars as one ARGB8888 image, shown with a single texture upload
+// instead of a draw call per star. Drawing is two parallel passes: one over
+// the stars works out each star's pixel and colour, then one over bands of
+// rows writes the stars that land in each band, so no pixel has two writers.
+class RenderBuffer{
+
+public:
+  int width;
+  int height;
+  std::vector<uint32_t> pixels; // row by row, opaque black where there is no star
+
+public:
+  RenderBuffer();
+  void resize(int width, int height);
+  // 2D stars where they are, in the colours they were given
+  void draw(const Point *stars, int num_stars, TaskScheduler &scheduler);
+  // 3D stars seen through the camera, the nearest one taking each pixel
+  void draw(const Octree::Body *stars, int num_stars, const Camera &camera, const StarColoring &coloring, TaskScheduler &scheduler);
+
+private:
+  std::vector<int> star_pixels; // -1 when off screen or behind the camera
+  std::vector<uint32_t> star_colors;
+  std::vector<float> star_depths;
+  std::vector<float> depths;    // per pixel, of the star drawn there
+
+  void fill(int num_stars, bool depth_test, TaskScheduler &scheduler);
+};
+#endif
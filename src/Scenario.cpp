@@ -0,0 +1,415 @@
+#include "Scenario.hpp"
+#include <errno.h>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Scenario::Scenario() {
+  num_stars = 20000;
+  dimensions = 2;
+
+  solver = SOLVER_BARNES_HUT;
+  gravity_strength = 200.f;
+  max_speed = 100.0f;
+  theta = 1.7f;
+  soft_power = 2;
+  float_forces = false;
+  cost_zones = true;
+  reorder_interval = 10;
+  leaf_capacity = 1;
+
+  dt = 1.0/60;
+  steps = 100;
+  threads = 0;
+  tuned = true;
+  deterministic = false;
+
+  record_bits = 16;
+  keyframe_interval = 60;
+  checkpoint_every = 500;
+  checkpoint_seconds = 0;
+
+  color[0] = 0.0f;
+  color[1] = 0.4f;
+  color[2] = 1.0f;
+  color_mode = 0;
+}
+
+static std::string trim(const std::string &text) {
+  size_t begin = text.find_first_not_of(" \t\r");
+  size_t end = text.find_last_not_of(" \t\r");
+  return begin == std::string::npos ? std::string() : text.substr(begin, end - begin + 1);
+}
+
+static bool parse_double(const std::string &value, double *result) {
+  char *end;
+  errno = 0;
+  *result = strtod(value.c_str(), &end);
+  return !value.empty() && *end == '\0' && errno == 0;
+}
+
+static bool parse_int(const std::string &value, int *result) {
+  char *end;
+  errno = 0;
+  long parsed = strtol(value.c_str(), &end, 10);
+  *result = (int)parsed;
+  return !value.empty() && *end == '\0' && errno == 0 && parsed == *result;
+}
+
+bool parse_seed(const char *text, uint64_t *seed) {
+  // strtoull would take a minus sign and wrap the number around
+  if (text[0] < '0' || text[0] > '9') {
+    return false;
+  }
+  char *end;
+  errno = 0;
+  unsigned long long parsed = strtoull(text, &end, 10);
+  if (*end != '\0' || errno != 0) {
+    return false;
+  }
+  *seed = (uint64_t)parsed;
+  return true;
+}
+
+static bool parse_float(const std::string &value, float *result) {
+  double parsed;
+  bool ok = parse_double(value, &parsed);
+  *result = (float)parsed;
+  return ok;
+}
+
+static bool parse_bool(const std::string &value, bool *result) {
+  if (value == "true" || value == "yes" || value == "1") {
+    *result = true;
+    return true;
+  }
+  if (value == "false" || value == "no" || value == "0") {
+    *result = false;
+    return true;
+  }
+  return false;
+}
+
+static bool parse_color(const std::string &value, float *color) {
+  std::istringstream numbers(value);
+  std::string extra;
+  return (bool)(numbers >> color[0] >> color[1] >> color[2]) && !(numbers >> extra);
+}
+
+// Sets one key; `problem` is left empty for a key that does not exist and
+// describes the value otherwise.
+static bool set_value(Scenario &scenario, const std::string &section, const std::string &key, const std::string &value, std::string *problem) {
+  InitialConditions &conditions = scenario.conditions;
+  ThetaController &controller = scenario.theta_controller;
+  bool ok = false;
+  bool known = true;
+  if (section == "galaxy") {
+    if (key == "stars") ok = parse_int(value, &scenario.num_stars) && scenario.num_stars >= 0;
+    else if (key == "dimensions") ok = parse_int(value, &scenario.dimensions) && (scenario.dimensions == 2 || scenario.dimensions == 3);
+    else if (key == "model") ok = (conditions.model = find_galaxy_model(value.c_str())) >= 0;
+    else if (key == "radius") ok = parse_double(value, &conditions.radius) && conditions.radius > 0;
+    else if (key == "seed") ok = parse_seed(value.c_str(), &conditions.seed);
+    else if (key == "velocity_scale") ok = parse_double(value, &conditions.velocity_scale);
+    else if (key == "galaxies") ok = parse_int(value, &conditions.num_galaxies) && conditions.num_galaxies > 0;
+    else if (key == "separation") ok = parse_double(value, &conditions.separation);
+    else if (key == "approach_speed") ok = parse_double(value, &conditions.approach_speed);
+    else if (key == "snapshot") ok = !(scenario.snapshot_path = value).empty();
+    else known = false;
+  }
+  else if (section == "physics") {
+    if (key == "solver") ok = (scenario.solver = find_solver(value.c_str())) >= 0;
+    else if (key == "gravity") ok = parse_float(value, &scenario.gravity_strength);
+    else if (key == "max_speed") ok = parse_float(value, &scenario.max_speed);
+    else if (key == "theta") ok = parse_float(value, &scenario.theta) && scenario.theta >= 0;
+    else if (key == "softening") ok = parse_int(value, &scenario.soft_power);
+    else if (key == "float_forces") ok = parse_bool(value, &scenario.float_forces);
+    else if (key == "cost_zones") ok = parse_bool(value, &scenario.cost_zones);
+    else if (key == "reorder_interval") ok = parse_int(value, &scenario.reorder_interval) && scenario.reorder_interval >= 0;
+    else if (key == "leaf_capacity") ok = parse_int(value, &scenario.leaf_capacity) && scenario.leaf_capacity > 0;
+    else if (key == "adaptive_theta") ok = (controller.mode = find_theta_mode(value.c_str())) >= 0;
+    else if (key == "target_step_ms") ok = parse_double(value, &controller.target_ms) && controller.target_ms > 0;
+    else if (key == "target_error") ok = parse_double(value, &controller.target_error) && controller.target_error > 0;
+    else if (key == "min_theta") ok = parse_float(value, &controller.min_theta) && controller.min_theta > 0;
+    else if (key == "max_theta") ok = parse_float(value, &controller.max_theta) && controller.max_theta > 0;
+    else known = false;
+  }
+  else if (section == "run") {
+    if (key == "dt") ok = parse_double(value, &scenario.dt) && scenario.dt >= 0;
+    else if (key == "steps") ok = parse_int(value, &scenario.steps) && scenario.steps >= 0;
+    else if (key == "threads") ok = parse_int(value, &scenario.threads) && scenario.threads >= 0;
+    else if (key == "tuned") ok = parse_bool(value, &scenario.tuned);
+    else if (key == "deterministic") ok = parse_bool(value, &scenario.deterministic);
+    else known = false;
+  }
+  else if (section == "output") {
+    if (key == "save") ok = !(scenario.save_path = value).empty();
+    else if (key == "record") ok = !(scenario.record_path = value).empty();
+    else if (key == "record_bits") ok = parse_int(value, &scenario.record_bits) && scenario.record_bits >= 8 && scenario.record_bits <= 24;
+    else if (key == "keyframe_interval") ok = parse_int(value, &scenario.keyframe_interval) && scenario.keyframe_interval > 0;
+    else if (key == "checkpoint") ok = !(scenario.checkpoint_path = value).empty();
+    else if (key == "checkpoint_every") ok = parse_int(value, &scenario.checkpoint_every) && scenario.checkpoint_every >= 0;
+    else if (key == "checkpoint_seconds") ok = parse_int(value, &scenario.checkpoint_seconds) && scenario.checkpoint_seconds >= 0;
+    else if (key == "trace") ok = !(scenario.trace_path = value).empty();
+    else if (key == "summary") ok = !(scenario.summary_path = value).empty();
+    else known = false;
+  }
+  else if (section == "display") {
+    if (key == "color") ok = parse_color(value, scenario.color);
+    else if (key == "color_mode") ok = parse_int(value, &scenario.color_mode) && scenario.color_mode >= 0 && scenario.color_mode <= 2;
+    else known = false;
+  }
+  else if (section == "timeline") {
+    // the key is the step and the parameter
+    std::istringstream words(key);
+    long step;
+    std::string name, extra;
+    int parameter = -1;
+    double number = 0;
+    if (words >> step >> name && !(words >> extra) && step >= 0 && (parameter = find_parameter(name.c_str())) >= 0) {
+      bool flag = false;
+      if (parameter == PARAM_FLOAT_FORCES || parameter == PARAM_COST_ZONES) {
+        ok = parse_bool(value, &flag);
+        number = flag;
+      }
+      else if (parameter == PARAM_SOLVER) {
+        number = find_solver(value.c_str());
+        ok = number >= 0;
+      }
+      else {
+        ok = parse_double(value, &number);
+      }
+      if (ok) {
+        scenario.timeline.add(step, parameter, number);
+      }
+    }
+    else {
+      known = false;
+    }
+  }
+  else if (section == "ensemble") {
+    // every value has to be good for the setting it is for
+    size_t dot = key.find('.');
+    EnsembleAxis axis;
+    axis.section = key.substr(0, dot);
+    axis.key = dot == std::string::npos ? std::string() : key.substr(dot + 1);
+    std::istringstream words(value);
+    std::string word;
+    while (words >> word) {
+      axis.values.push_back(word);
+    }
+    known = axis.section != "ensemble" && axis.section != "timeline" && !axis.key.empty();
+    ok = known && !axis.values.empty();
+    for (size_t i = 0; ok && i < axis.values.size(); i++) {
+      Scenario trial = scenario;
+      std::string value_problem;
+      if (!set_value(trial, axis.section, axis.key, axis.values[i], &value_problem)) {
+        ok = false;
+        known = !value_problem.empty();
+      }
+    }
+    if (ok) {
+      scenario.ensemble.push_back(axis);
+    }
+  }
+  else {
+    known = false;
+  }
+  problem->clear();
+  if (known && !ok) {
+    *problem = "bad value '" + value + "' for " + key;
+  }
+  return ok;
+}
+
+bool Scenario::load(const char *path, std::string *error) {
+  std::ifstream file(path);
+  if (!file) {
+    if (error != nullptr) {
+      *error = std::string("could not open ") + path + ": " + strerror(errno);
+    }
+    return false;
+  }
+  std::string line;
+  std::string section;
+  int line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    size_t comment = line.find_first_of(";#");
+    line = trim(line.substr(0, comment));
+    if (line.empty()) {
+      continue;
+    }
+    std::string problem;
+    if (line[0] == '[') {
+      if (line[line.size() - 1] != ']') {
+        problem = "unterminated section";
+      }
+      section = trim(line.substr(1, line.size() - 2));
+    }
+    else {
+      size_t equals = line.find('=');
+      std::string key = trim(line.substr(0, equals));
+      std::string value = equals == std::string::npos ? std::string() : trim(line.substr(equals + 1));
+      if (equals == std::string::npos) {
+        problem = "expected key = value";
+      }
+      else if (!set_value(*this, section, key, value, &problem) && problem.empty()) {
+        problem = "unknown setting " + key + (section.empty() ? std::string() : " in [" + section + "]");
+      }
+    }
+    if (!problem.empty()) {
+      if (error != nullptr) {
+        std::ostringstream message;
+        message << path << ":" << line_number << ": " << problem;
+        *error = message.str();
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+void Scenario::apply(Galaxy &galaxy) const {
+  galaxy.solver = solver;
+  galaxy.gravity_strength = gravity_strength;
+  galaxy.max_speed = max_speed;
+  galaxy.theta = theta;
+  galaxy.soft_power = soft_power;
+  galaxy.float_forces = float_forces;
+  galaxy.cost_zones = cost_zones;
+  galaxy.reorder_interval = reorder_interval;
+  galaxy.leaf_capacity = leaf_capacity;
+  galaxy.theta_controller = theta_controller;
+}
+
+void Scenario::use_tuned_settings(const TunedSettings &settings) {
+  if (!tuned) {
+    return;
+  }
+  // the thread count is the only one that leaves the stars as they were
+  if (!deterministic) {
+    leaf_capacity = settings.leaf_capacity;
+    float_forces = settings.float_forces;
+  }
+  if (threads == 0) {
+    threads = settings.threads;
+  }
+}
+
+std::vector<Scenario> Scenario::ensemble_members(std::vector<std::string> *labels) const {
+  Scenario base = *this;
+  base.ensemble.clear();
+  std::vector<Scenario> members(1, base);
+  labels->assign(1, std::string());
+  for (size_t a = 0; a < ensemble.size(); a++) {
+    const EnsembleAxis &axis = ensemble[a];
+    std::vector<Scenario> combined;
+    std::vector<std::string> combined_labels;
+    for (size_t m = 0; m < members.size(); m++) {
+      for (size_t v = 0; v < axis.values.size(); v++) {
+        Scenario member = members[m];
+        std::string problem;
+        set_value(member, axis.section, axis.key, axis.values[v], &problem);
+        combined.push_back(member);
+        combined_labels.push_back((*labels)[m] + (a > 0 ? " " : "") + axis.key + "=" + axis.values[v]);
+      }
+    }
+    members.swap(combined);
+    labels->swap(combined_labels);
+  }
+  return members;
+}
+
+std::string Scenario::nondeterminism() const {
+  if (!deterministic) {
+    return "";
+  }
+  if (theta_controller.mode == THETA_STEP_TIME) {
+    return "a step-time adaptive theta depends on timing, it cannot be deterministic";
+  }
+  if (dt <= 0) {
+    return "a deterministic run needs a fixed time step";
+  }
+  return "";
+}
+
+void Scenario::capture(const Galaxy &galaxy) {
+  solver = galaxy.solver;
+  gravity_strength = galaxy.gravity_strength;
+  max_speed = galaxy.max_speed;
+  theta = galaxy.theta;
+  soft_power = galaxy.soft_power;
+  float_forces = galaxy.float_forces;
+  cost_zones = galaxy.cost_zones;
+  reorder_interval = galaxy.reorder_interval;
+  leaf_capacity = galaxy.leaf_capacity;
+  theta_controller = galaxy.theta_controller;
+}
+
+bool Scenario::save(const char *path, std::string *error) const {
+  FILE *file = fopen(path, "w");
+  if (file == nullptr) {
+    if (error != nullptr) {
+      *error = std::string("could not create ") + path + ": " + strerror(errno);
+    }
+    return false;
+  }
+  // doubles with 17 digits and floats with 9 come back exactly
+  fprintf(file, "[galaxy]\nstars = %d\ndimensions = %d\nmodel = %s\nradius = %.17g\nseed = %llu\nvelocity_scale = %.17g\n",
+          num_stars, dimensions, galaxy_model_names[conditions.model], conditions.radius, (unsigned long long)conditions.seed, conditions.velocity_scale);
+  fprintf(file, "galaxies = %d\nseparation = %.17g\napproach_speed = %.17g\n",
+          conditions.num_galaxies, conditions.separation, conditions.approach_speed);
+  if (!snapshot_path.empty()) {
+    fprintf(file, "snapshot = %s\n", snapshot_path.c_str());
+  }
+  fprintf(file, "\n[physics]\nsolver = %s\ngravity = %.9g\nmax_speed = %.9g\ntheta = %.9g\nsoftening = %d\n",
+          solver_names[solver], gravity_strength, max_speed, theta, soft_power);
+  fprintf(file, "float_forces = %s\ncost_zones = %s\nreorder_interval = %d\nleaf_capacity = %d\n",
+          float_forces ? "true" : "false", cost_zones ? "true" : "false", reorder_interval, leaf_capacity);
+  fprintf(file, "adaptive_theta = %s\ntarget_step_ms = %.17g\ntarget_error = %.17g\nmin_theta = %.9g\nmax_theta = %.9g\n",
+          theta_mode_names[theta_controller.mode], theta_controller.target_ms, theta_controller.target_error,
+          theta_controller.min_theta, theta_controller.max_theta);
+  fprintf(file, "\n[run]\ndt = %.17g\nsteps = %d\nthreads = %d\ntuned = %s\ndeterministic = %s\n", dt, steps, threads,
+          tuned ? "true" : "false", deterministic ? "true" : "false");
+  fprintf(file, "\n[output]\n");
+  const std::string *paths[] = {&save_path, &record_path, &checkpoint_path, &trace_path, &summary_path};
+  const char *path_keys[] = {"save", "record", "checkpoint", "trace", "summary"};
+  for (int i = 0; i < 5; i++) {
+    if (!paths[i]->empty()) {
+      fprintf(file, "%s = %s\n", path_keys[i], paths[i]->c_str());
+    }
+  }
+  fprintf(file, "record_bits = %d\nkeyframe_interval = %d\ncheckpoint_every = %d\ncheckpoint_seconds = %d\n",
+          record_bits, keyframe_interval, checkpoint_every, checkpoint_seconds);
+  fprintf(file, "\n[display]\ncolor = %.9g %.9g %.9g\ncolor_mode = %d\n", color[0], color[1], color[2], color_mode);
+  if (!timeline.changes.empty()) {
+    fprintf(file, "\n[timeline]\n");
+    for (size_t i = 0; i < timeline.changes.size(); i++) {
+      const ParameterChange &change = timeline.changes[i];
+      if (change.parameter == PARAM_SOLVER) {
+        fprintf(file, "%ld %s = %s\n", change.step, parameter_names[change.parameter], solver_names[(int)change.value]);
+      }
+      else {
+        fprintf(file, "%ld %s = %.9g\n", change.step, parameter_names[change.parameter], change.value);
+      }
+    }
+  }
+  if (!ensemble.empty()) {
+    fprintf(file, "\n[ensemble]\n");
+    for (size_t a = 0; a < ensemble.size(); a++) {
+      fprintf(file, "%s.%s =", ensemble[a].section.c_str(), ensemble[a].key.c_str());
+      for (size_t v = 0; v < ensemble[a].values.size(); v++) {
+        fprintf(file, " %s", ensemble[a].values[v].c_str());
+      }
+      fprintf(file, "\n");
+    }
+  }
+  bool ok = !ferror(file);
+  ok = fclose(file) == 0 && ok;
+  if (!ok && error != nullptr) {
+    *error = std::string("could not write ") + path;
+  }
+  return ok;
+}
@@ -0,0 +1,114 @@
+#ifndef SCENARIO_H
+#define SCENARIO_H
+#include <string>
+#include <vector>
+#include "Autotune.hpp"
+#include "Galaxy.hpp"
+#include "InitialConditions.hpp"
+#include "Timeline.hpp"
+
+// Everything a run is made of, so experiments can be repeated without
+// recompiling. Scenario files are INI style:
+//
+//   ; comments start with ; or #
+//   [galaxy]
+//   stars = 100000
+//   model = collision
+//
+// Sections and keys:
+//   [galaxy]   stars, dimensions (2, or 3 for an octree galaxy), model,
+//              radius, seed, velocity_scale, galaxies, separation,
+//              approach_speed, snapshot (start from this file instead, with
+//              its own physics; 2D only)
+//   [physics]  solver (barnes-hut or direct), gravity, max_speed, theta, softening,
+//              float_forces, cost_zones, reorder_interval, leaf_capacity,
+//              adaptive_theta
+//              (off, step-time or force-error), target_step_ms,
+//              target_error, min_theta, max_theta
+//   [run]      dt (0 in the GUI: the frame time), steps, threads (0: all
+//              cores, or the tuned count), tuned (take leaf_capacity,
+//              float_forces and threads from --autotune's results),
+//              deterministic (only settings that give the same run every
+//              time: a fixed time step, no step-time adaptive theta, and of
+//              the tuned settings only the thread count)
+//   [output]   save, record, record_bits, keyframe_interval, checkpoint,
+//              checkpoint_every, checkpoint_seconds, trace, summary (of an
+//              ensemble)
+//   [display]  color (three numbers from 0 to 1), color_mode
+//   [timeline] STEP PARAMETER = VALUE, e.g. "300 gravity = 500": sets a
+//              [physics] setting once the galaxy reaches the step
+//   [ensemble] SECTION.KEY = VALUE VALUE ..., e.g. "physics.theta = 0.5 1":
+//              --ensemble runs every combination of the listed values
+// Anything left out keeps the default below; unknown sections and keys are
+// errors, so a misspelt setting cannot silently fall back to its default.
+// one setting an ensemble runs with each of several values
+struct EnsembleAxis{
+  std::string section;
+  std::string key;
+  std::vector<std::string> values;
+};
+
+struct Scenario{
+  int num_stars;
+  int dimensions;
+  InitialConditions conditions; // center is up to the caller
+  std::string snapshot_path;
+
+  int solver;
+  float gravity_strength;
+  float max_speed;
+  float theta;
+  int soft_power;
+  bool float_forces;
+  bool cost_zones;
+  int reorder_interval;
+  int leaf_capacity;
+  ThetaController theta_controller;
+
+  double dt;
+  int steps;
+  int threads;
+  bool tuned;
+  bool deterministic;
+
+  std::string save_path;
+  std::string record_path;
+  int record_bits;
+  int keyframe_interval;
+  std::string checkpoint_path;
+  int checkpoint_every;
+  int checkpoint_seconds;
+  std::string trace_path;
+  std::string summary_path;
+
+  float color[3];
+  int color_mode;
+
+  Timeline timeline;
+  std::vector<EnsembleAxis> ensemble;
+
+  Scenario();
+  // reads a scenario file over the current values
+  bool load(const char *path, std::string *error);
+  // the physics settings, for a galaxy that was not loaded from a snapshot
+  // (which keeps its own, all but the adaptive theta)
+  void apply(Galaxy &galaxy) const;
+  // Takes what --autotune found for this host, if tuned is set: the leaf
+  // capacity and kernel (unless deterministic), and the thread count unless
+  // one was given.
+  void use_tuned_settings(const TunedSettings &settings);
+  // the galaxy's physics settings, the other way round
+  void capture(const Galaxy &galaxy);
+  // The scenario once for every combination of the ensemble's values (just
+  // itself without one), each with a label naming the values it got.
+  std::vector<Scenario> ensemble_members(std::vector<std::string> *labels) const;
+  // why the scenario cannot be deterministic, empty if it can or need not be
+  std::string nondeterminism() const;
+  // writes a file load reads back to the same scenario
+  bool save(const char *path, std::string *error) const;
+};
+
+// A seed as written by Scenario::save: a whole number from 0 to 2^64 - 1,
+// nothing before or after it. False, leaving *seed alone, otherwise.
+bool parse_seed(const char *text, uint64_t *seed);
+#endif
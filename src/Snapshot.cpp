@@ -0,0 +1,327 @@
+#include "Snapshot.hpp"
+#include <errno.h>
+#include <cmath>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(SnapshotHeader) == 232, "snapshot header layout changed, bump SNAPSHOT_VERSION");
+
+static uint64_t align_up(uint64_t offset) {
+  return (offset + 63) & ~(uint64_t)63;
+}
+
+static uint64_t column_size(int column, int64_t num_stars) {
+  return num_stars*(column == COLUMN_ID ? sizeof(int32_t) : sizeof(double));
+}
+
+static void set_message(std::string *error, const std::string &message) {
+  if (error != nullptr) {
+    *error = message;
+  }
+}
+
+// message for a failed system call, naming the file
+static void set_error(std::string *error, const char *what, const char *path) {
+  set_message(error, std::string(what) + " " + path + ": " + strerror(errno));
+}
+
+// True if the header's physics are what the GUI could have set: finite and
+// inside the sliders' ranges, on walls that enclose something.
+static bool valid_physics(const SnapshotHeader *h) {
+  return std::isfinite(h->gravity_strength) && h->gravity_strength >= 0 && h->gravity_strength <= 1000 &&
+         std::isfinite(h->max_speed) && h->max_speed >= 0 && h->max_speed <= 1000 &&
+         std::isfinite(h->theta) && h->theta >= 0 && h->theta <= 5 &&
+         h->soft_power >= -5 && h->soft_power <= 5 &&
+         h->reorder_interval >= 0 && h->reorder_interval <= 100 &&
+         h->float_forces <= 1 && h->cost_zones <= 1 &&
+         std::isfinite(h->world_width) && h->world_width > 0 &&
+         std::isfinite(h->world_height) && h->world_height > 0 &&
+         h->solver >= 0 && h->solver < SOLVER_COUNT &&
+         h->leaf_capacity >= 1 && h->leaf_capacity <= 32;
+}
+
+// the adaptive theta's targets as a scenario may set them, and measurements
+// it could have made
+static bool valid_theta_controller(const SnapshotHeader *h) {
+  return h->theta_mode >= 0 && h->theta_mode < THETA_MODE_COUNT && h->new_sample <= 1 &&
+         std::isfinite(h->target_ms) && h->target_ms > 0 &&
+         std::isfinite(h->target_error) && h->target_error > 0 &&
+         std::isfinite(h->min_theta) && h->min_theta > 0 &&
+         std::isfinite(h->max_theta) && h->max_theta > 0 &&
+         std::isfinite(h->step_ms) && h->step_ms >= 0 &&
+         std::isfinite(h->force_error) && h->force_error >= 0 &&
+         std::isfinite(h->interactions) && h->interactions >= 0 &&
+         std::isfinite(h->sample_factor) && h->sample_factor > 0 &&
+         h->sample_steps_left >= 0;
+}
+
+// pwrite() may write less than asked for, keep going until it is all out
+static bool write_all(int fd, const void *data, size_t size, uint64_t offset) {
+  const char *bytes = (const char *)data;
+  while (size > 0) {
+    ssize_t written = pwrite(fd, bytes, size, offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    bytes += written;
+    size -= written;
+    offset += written;
+  }
+  return true;
+}
+
+void SnapshotData::capture(Galaxy &galaxy) {
+  int n = galaxy.num_stars();
+  ids.resize(n);
+  x.resize(n);
+  y.resize(n);
+  vx.resize(n);
+  vy.resize(n);
+  mass.resize(n);
+  auto copy_stars = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      const Point &p = galaxy.stars[i];
+      ids[i] = galaxy.star_ids[i];
+      x[i] = p.x;
+      y[i] = p.y;
+      vx[i] = p.vx;
+      vy[i] = p.vy;
+      mass[i] = 1;
+    }
+  };
+  galaxy.scheduler->parallel_for(0, n, 16384, copy_stars);
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.byte_order = SNAPSHOT_BYTE_ORDER;
+  header.header_size = sizeof(SnapshotHeader);
+  header.num_stars = n;
+  header.step_number = galaxy.step_number;
+  header.gravity_strength = galaxy.gravity_strength;
+  header.max_speed = galaxy.max_speed;
+  header.theta = galaxy.theta;
+  header.soft_power = galaxy.soft_power;
+  header.reorder_interval = galaxy.reorder_interval;
+  header.float_forces = galaxy.float_forces;
+  header.cost_zones = galaxy.cost_zones;
+  header.world_width = galaxy.screen_width;
+  header.world_height = galaxy.screen_height;
+  header.solver = galaxy.solver;
+  header.leaf_capacity = galaxy.leaf_capacity;
+  const ThetaController &controller = galaxy.theta_controller;
+  header.theta_mode = controller.mode;
+  header.target_ms = controller.target_ms;
+  header.target_error = controller.target_error;
+  header.min_theta = controller.min_theta;
+  header.max_theta = controller.max_theta;
+  header.step_ms = controller.step_ms;
+  header.force_error = controller.force_error;
+  header.interactions = controller.interactions;
+  header.new_sample = controller.new_sample;
+  header.sample_factor = controller.sample_factor;
+  header.sample_steps_left = controller.sample_steps_left;
+  uint64_t offset = align_up(sizeof(SnapshotHeader));
+  for (int column = 0; column < COLUMN_COUNT; column++) {
+    header.column_offsets[column] = offset;
+    offset = align_up(offset + column_size(column, n));
+  }
+  header.file_size = offset;
+}
+
+bool SnapshotData::write(const char *path, std::string *error) const {
+  std::string temporary = std::string(path) + ".tmp";
+  int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    set_error(error, "could not create", temporary.c_str());
+    return false;
+  }
+  const void *columns[COLUMN_COUNT] = {ids.data(), x.data(), y.data(), vx.data(), vy.data(), mass.data()};
+  bool ok = ftruncate(fd, header.file_size) == 0 && write_all(fd, &header, sizeof(header), 0);
+  for (int column = 0; ok && column < COLUMN_COUNT; column++) {
+    ok = write_all(fd, columns[column], column_size(column, header.num_stars), header.column_offsets[column]);
+  }
+  ok = ok && fsync(fd) == 0;
+  if (!ok) {
+    set_error(error, "could not write", temporary.c_str());
+  }
+  if (::close(fd) != 0 && ok) {
+    set_error(error, "could not write", temporary.c_str());
+    ok = false;
+  }
+  if (ok && rename(temporary.c_str(), path) != 0) {
+    set_error(error, "could not rename to", path);
+    ok = false;
+  }
+  if (!ok) {
+    unlink(temporary.c_str());
+  }
+  return ok;
+}
+
+SnapshotFile::SnapshotFile() {
+  header = nullptr;
+  ids = nullptr;
+  x = nullptr;
+  y = nullptr;
+  vx = nullptr;
+  vy = nullptr;
+  mass = nullptr;
+  mapping = nullptr;
+  mapping_size = 0;
+}
+
+SnapshotFile::~SnapshotFile() {
+  close();
+}
+
+bool SnapshotFile::open(const char *path, std::string *error) {
+  close();
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    set_error(error, "could not open", path);
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    set_error(error, "could not stat", path);
+    ::close(fd);
+    return false;
+  }
+  if ((size_t)info.st_size < sizeof(SnapshotHeader)) {
+    ::close(fd);
+    set_message(error, std::string(path) + " is too short to be a snapshot");
+    return false;
+  }
+  void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    set_error(error, "could not map", path);
+    return false;
+  }
+  mapping = data;
+  mapping_size = info.st_size;
+  madvise(mapping, mapping_size, MADV_WILLNEED);
+
+  const SnapshotHeader *h = (const SnapshotHeader *)mapping;
+  const char *problem = nullptr;
+  if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0) {
+    problem = "is not a snapshot";
+  }
+  else if (h->byte_order != SNAPSHOT_BYTE_ORDER) {
+    problem = "was written on a machine of the other byte order";
+  }
+  else if (h->version != SNAPSHOT_VERSION || h->header_size != sizeof(SnapshotHeader)) {
+    problem = "has an unsupported snapshot version";
+  }
+  else if (h->file_size != mapping_size || h->num_stars < 0 || h->num_stars > INT32_MAX || !valid_physics(h) ||
+           !valid_theta_controller(h)) {
+    problem = "is truncated or corrupt";
+  }
+  for (int column = 0; problem == nullptr && column < COLUMN_COUNT; column++) {
+    uint64_t offset = h->column_offsets[column];
+    // written so a corrupt offset near 2^64 cannot wrap around
+    if (offset % 64 != 0 || offset < sizeof(SnapshotHeader) || offset > mapping_size ||
+        column_size(column, h->num_stars) > mapping_size - offset) {
+      problem = "is truncated or corrupt";
+    }
+  }
+  if (problem != nullptr) {
+    set_message(error, std::string(path) + " " + problem);
+    close();
+    return false;
+  }
+
+  const char *base = (const char *)mapping;
+  header = h;
+  ids = (const int32_t *)(base + h->column_offsets[COLUMN_ID]);
+  x = (const double *)(base + h->column_offsets[COLUMN_X]);
+  y = (const double *)(base + h->column_offsets[COLUMN_Y]);
+  vx = (const double *)(base + h->column_offsets[COLUMN_VX]);
+  vy = (const double *)(base + h->column_offsets[COLUMN_VY]);
+  mass = (const double *)(base + h->column_offsets[COLUMN_MASS]);
+  // every id exactly once, or restore() would leave slots stale
+  std::vector<bool> seen(h->num_stars, false);
+  for (int64_t i = 0; i < h->num_stars; i++) {
+    if (ids[i] < 0 || ids[i] >= h->num_stars || seen[ids[i]]) {
+      set_message(error, std::string(path) + " has an invalid or repeated star id");
+      close();
+      return false;
+    }
+    seen[ids[i]] = true;
+  }
+  return true;
+}
+
+void SnapshotFile::close() {
+  if (mapping != nullptr) {
+    munmap(mapping, mapping_size);
+  }
+  mapping = nullptr;
+  mapping_size = 0;
+  header = nullptr;
+  ids = nullptr;
+  x = nullptr;
+  y = nullptr;
+  vx = nullptr;
+  vy = nullptr;
+  mass = nullptr;
+}
+
+void SnapshotFile::restore(Galaxy &galaxy) const {
+  int n = (int)header->num_stars;
+  galaxy.resize(n);
+  auto copy_stars = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      galaxy.stars[i] = Point(x[i], y[i], vx[i], vy[i], 0, 0);
+      galaxy.star_ids[i] = ids[i];
+      galaxy.star_slots[ids[i]] = i;
+      galaxy.star_costs[i] = 0;
+    }
+  };
+  galaxy.scheduler->parallel_for(0, n, 16384, copy_stars);
+
+  galaxy.step_number = header->step_number;
+  galaxy.gravity_strength = (float)header->gravity_strength;
+  galaxy.max_speed = (float)header->max_speed;
+  galaxy.theta = (float)header->theta;
+  galaxy.soft_power = header->soft_power;
+  galaxy.reorder_interval = header->reorder_interval;
+  galaxy.float_forces = header->float_forces != 0;
+  galaxy.cost_zones = header->cost_zones != 0;
+  galaxy.solver = header->solver;
+  galaxy.leaf_capacity = header->leaf_capacity;
+  ThetaController &controller = galaxy.theta_controller;
+  controller.mode = header->theta_mode;
+  controller.target_ms = header->target_ms;
+  controller.target_error = header->target_error;
+  controller.min_theta = (float)header->min_theta;
+  controller.max_theta = (float)header->max_theta;
+  controller.step_ms = header->step_ms;
+  controller.force_error = header->force_error;
+  controller.interactions = header->interactions;
+  controller.new_sample = header->new_sample != 0;
+  controller.sample_factor = header->sample_factor;
+  controller.sample_steps_left = header->sample_steps_left;
+}
+
+bool save_snapshot(Galaxy &galaxy, const char *path, std::string *error) {
+  SnapshotData data;
+  data.capture(galaxy);
+  return data.write(path, error);
+}
+
+bool load_snapshot(Galaxy &galaxy, const char *path, std::string *error) {
+  SnapshotFile file;
+  if (!file.open(path, error)) {
+    return false;
+  }
+  file.restore(galaxy);
+  return true;
+}
@@ -0,0 +1,115 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "Galaxy.hpp"
+
+// Snapshot file layout, version 2: the header, then one column per field
+// (ids, x, y, vx, vy, mass), each starting on a 64 byte boundary at the
+// offset the header gives. Stars are stored in slot order with their ids,
+// so a loaded galaxy keeps its memory order and star identities.
+const char SNAPSHOT_MAGIC[8] = {'S', 'T', 'A', 'R', 'S', 'N', 'A', 'P'};
+const uint32_t SNAPSHOT_VERSION = 2;
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+enum SnapshotColumn {
+  COLUMN_ID,   // int32
+  COLUMN_X,    // double from here on
+  COLUMN_Y,
+  COLUMN_VX,
+  COLUMN_VY,
+  COLUMN_MASS, // in units of the point mass, 1 for every star for now
+  COLUMN_COUNT
+};
+
+struct SnapshotHeader{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order; // written as SNAPSHOT_BYTE_ORDER, reads back differently on another endianness
+  uint64_t header_size;
+  uint64_t file_size;
+  int64_t num_stars;
+  int64_t step_number;
+
+  // simulation parameters
+  double gravity_strength;
+  double max_speed;
+  double theta;
+  int32_t soft_power;
+  int32_t reorder_interval;
+  uint8_t float_forces;
+  uint8_t cost_zones;
+  uint8_t new_sample; // adaptive theta: a force error sample not acted on yet
+  uint8_t unused[5];
+  double world_width; // screen size the galaxy was simulated in
+  double world_height;
+  int32_t solver;
+  int32_t leaf_capacity;
+
+  // adaptive theta, its targets and where it had got to (see ThetaController),
+  // so a resumed run adapts as the uninterrupted one would have
+  int32_t theta_mode;
+  int32_t sample_steps_left;
+  double target_ms;
+  double target_error;
+  double min_theta;
+  double max_theta;
+  double step_ms;
+  double force_error;
+  double interactions;
+  double sample_factor;
+
+  uint64_t column_offsets[COLUMN_COUNT];
+};
+
+// A galaxy's state copied out column by column, ready to be written. Kept
+// around between captures so repeated snapshots reuse their memory.
+struct SnapshotData{
+  SnapshotHeader header;
+  std::vector<int32_t> ids;
+  std::vector<double> x;
+  std::vector<double> y;
+  std::vector<double> vx;
+  std::vector<double> vy;
+  std::vector<double> mass;
+
+  void capture(Galaxy &galaxy);
+  // writes to path + ".tmp", syncs, then renames over path, so readers see
+  // either the old file or the complete new one
+  bool write(const char *path, std::string *error) const;
+};
+
+// A snapshot file mapped read-only. The column pointers point straight into
+// the mapping; nothing is parsed or copied until restore().
+class SnapshotFile{
+
+public:
+  const SnapshotHeader *header;
+  const int32_t *ids;
+  const double *x;
+  const double *y;
+  const double *vx;
+  const double *vy;
+  const double *mass;
+
+public:
+  SnapshotFile();
+  ~SnapshotFile();
+  bool open(const char *path, std::string *error);
+  void close();
+  // loads the stars, ids, step number, parameters and adaptive theta into the galaxy
+  void restore(Galaxy &galaxy) const;
+
+private:
+  void *mapping;
+  size_t mapping_size;
+
+  SnapshotFile(const SnapshotFile &);
+  SnapshotFile &operator=(const SnapshotFile &);
+};
+
+bool save_snapshot(Galaxy &galaxy, const char *path, std::string *error);
+bool load_snapshot(Galaxy &galaxy, const char *path, std::string *error);
+#endif
@@ -0,0 +1,804 @@
+#include "SpatialTree.hpp"
+#include <algorithm>
+#include <iostream>
+#include "Gravity.hpp"
+#include "helper.h"
+#include "Tracer.hpp"
+#include <cmath>
+#include <cstring>
+
+template <int Dim, typename Scalar> const int SpatialTree<Dim, Scalar>::CHILDREN;
+template <int Dim, typename Scalar> const int SpatialTree<Dim, Scalar>::MAX_LEVEL;
+
+// Z-order key of a position inside the root cell, picked by dimension
+static uint64_t morton_key(const double (&position)[2], const double *corner, double size) {
+  return morton_key(position[0], position[1], corner[0], corner[1], size);
+}
+
+static uint64_t morton_key(const double (&position)[3], const double *corner, double size) {
+  return morton_key(position[0], position[1], position[2], corner[0], corner[1], corner[2], size);
+}
+
+template <int Dim, typename Scalar>
+SpatialTree<Dim, Scalar>::SpatialTree(float gravity_strength, float max_speed, float theta, int soft_power) {
+  set_parameters(gravity_strength, max_speed, theta, soft_power);
+
+  for (int axis = 0; axis < Dim; axis++) {
+    center_of_mass[axis] = 0;
+    corner[axis] = 0;
+    origin[axis] = 0;
+    walls[axis] = 0;
+  }
+  num_stars = 0;
+  size = 1;
+  float_forces = false;
+  leaf_capacity = 1;
+  collect_stats = false;
+  tree_stats = TreeStats();
+  walk_stats = WalkStats();
+
+  stars = nullptr;
+  num_subtrees = 0;
+}
+
+template <int Dim, typename Scalar>
+void SpatialTree<Dim, Scalar>::set_parameters(float gravity_strength, float max_speed, float theta, int soft_power) {
+  // tunable
+  // ========
+  softening_factor = soft_power;
+  theta_threshold = theta;
+  point_mass = gravity_strength;
+  this->max_speed = max_speed;
+  // ========
+
+  double softening = pow(10, softening_factor);
+  softening_squared = softening*softening;
+}
+
+// min/max of the star positions in [begin, end), merged into the given extremes
+template <int Dim, typename Scalar>
+void SpatialTree<Dim, Scalar>::reduce_bounds(Body *stars, int begin, int end, Scalar *low, Scalar *high) {
+  for (int i = begin; i < end; i++) {
+    const Body &p = stars[i];
+    bool finite = true;
+    for (int axis = 0; axis < Dim; axis++) {
+      finite = finite && std::isfinite(Traits::position(p, axis));
+    }
+    if (!finite) {
+      continue;
+    }
+    for (int axis = 0; axis < Dim; axis++) {
+      low[axis] = std::min(low[axis], Traits::position(p, axis));
+      high[axis] = std::max(high[axis], Traits::position(p, axis));
+    }
+  }
+}
+
+// square root box enclosing every star, so every star is part of the tree
+template <int Dim, typename Scalar>
+void SpatialTree<Dim, Scalar>::compute_bounds(Body *stars, int num_stars, TaskScheduler &scheduler, Scalar *corner, Scalar *size) {
+  // independent partial reductions per chunk, merged at the end
+  const int max_chunks = 64;
+  Scalar partial[max_chunks][2][Dim];
+  int chunk = std::max(4096, (num_stars + max_chunks - 1)/max_chunks);
+  int num_chunks = (num_stars + chunk - 1)/chunk;
+  auto reduce_chunks = [&](int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      for (int axis = 0; axis < Dim; axis++) {
+        partial[c][0][axis] = INFINITY;
+        partial[c][1][axis] = -INFINITY;
+      }
+      reduce_bounds(stars, c*chunk, std::min((c + 1)*chunk, num_stars), partial[c][0], partial[c][1]);
+    }
+  };
+  scheduler.parallel_for(0, num_chunks, 1, reduce_chunks);
+
+  Scalar low[Dim], high[Dim];
+  for (int axis = 0; axis < Dim; axis++) {
+    low[axis] = INFINITY;
+    high[axis] = -INFINITY;
+    for (int c = 0; c < num_chunks; c++) {
+      low[axis] = std::min(low[axis], partial[c][0][axis]);
+      high[axis] = std::max(high[axis], partial[c][1][axis]);
+    }
+  }
+
+  if (low[0] > high[0]) { // no (finite) stars
+    for (int axis = 0; axis < Dim; axis++) {
+      corner[axis] = 0;
+    }
+    *size = 1;
+    return;
+  }
+
+  Scalar half = 0;
+  for (int axis = 0; axis < Dim; axis++) {
+    half = std::max(half, high[axis] - low[axis]);
+  }
+  half /= 2;
+  // pad slightly so stars on the edge stay inside after rounding
+  half = half*(1 + (Scalar)1e-9) + (Scalar)1e-9;
+  for (int axis = 0; axis < Dim; axis++) {
+    corner[axis] = (low[axis] + high[axis])/2 - half;
+  }
+  *size = 2*half;
+}
+
+// Moves a star on by dt, with the speed limit and the walls applied to each
+// axis on its own.
+template <int Dim, typename Scalar>
+void SpatialTree<Dim, Scalar>::calculate_motion(Body *p, double dt) {
+  for (int axis = 0; axis < Dim; axis++) {
+    Scalar &x = Traits::position(*p, axis);
+    Scalar &v = Traits::velocity(*p, axis);
+    Scalar a = Traits::acceleration(*p, axis);
+    v += a*dt;
+    if (v != 0) {
+      v = std::min<double>(std::fabs(v), max_speed)*(v/std::fabs(v));
+    }
+    x += v*dt + (1.0/2.0)*a*dt*dt;
+    // wall collisions
+    if (x < 10 || x > (walls[axis] - 10)) {
+      v *= -1;
+    }
+  }
+}
+
+// Returns the number of interactions the star needed, its cost for balancing.
+// Walk counters are added to `stats` when one is given.
+template <int Dim, typename Scalar>
+int SpatialTree<Dim, Scalar>::update_point_gravity(Body *p, WalkStats *stats) {
+  if (stats != nullptr) {
+    return float_forces ? walk<float, true>(p, blocks_float, stats) : walk<double, true>(p, blocks, stats);
+  }
+  return float_forces ? walk<float, false>(p, blocks_float, nullptr) : walk<double, false>(p, blocks, nullptr);
+}
+
+template <int Dim, typename Scalar>
+template <typename Real, bool Count>
+int SpatialTree<Dim, Scalar>::walk(Body *p, const std::vector<ChildBlock<Dim, Real> > &blocks, WalkStats *stats) {
+  if (nodes.empty()) {
+    return 0;
+  }
+  typedef typename ChildBlock<Dim, Real>::vec vec;
+  typedef typename ChildBlock<Dim, Real>::mask mask;
+
+  // everything below is relative to the root centre, which keeps the float
+  // variant accurate wherever the galaxy is; one frame for the whole tree
+  // rather than one per cell, since a batch mixes cells from all over it
+  Real position[Dim];
+  Real acceleration[Dim];
+  for (int axis = 0; axis < Dim; axis++) {
+    position[axis] = (Real)(Traits::position(*p, axis) - origin[axis]);
+    acceleration[axis] = 0;
+  }
+  Real softening = (Real)softening_squared;
+
+  // accepted nodes and single stars are queued and handed to the kernel in batches
+  const int batch_size = 64;
+  Real batch[Dim][batch_size];
+  Real batch_stars[batch_size];
+  const Real *batch_axes[Dim];
+  for (int axis = 0; axis < Dim; axis++) {
+    batch_axes[axis] = batch[axis];
+  }
+  int count = 0;
+  int interactions = 0;
+
+  double theta_squared = (double)theta_threshold*theta_threshold;
+  const Node &root = nodes[0];
+  if (root.split) {
+    double d_squared = 0;
+    for (int axis = 0; axis < Dim; axis++) {
+      double d = root.center_of_mass[axis] - Traits::position(*p, axis);
+      d_squared += d*d;
+    }
+    if (!((double)root.size*root.size > theta_squared*d_squared && d_squared > 0)) {
+      for (int axis = 0; axis < Dim; axis++) {
+        batch[axis][0] = (Real)(root.center_of_mass[axis] - origin[axis]);
+      }
+      batch_stars[0] = (Real)root.num_stars;
+      calculate_gravity<Dim, Real>(position, batch_axes, batch_stars, 1, softening, acceleration);
+      for (int axis = 0; axis < Dim; axis++) {
+        Traits::acceleration(*p, axis) += point_mass*acceleration[axis];
+      }
+      if (Count) {
+        stats->walks++;
+        stats->cells_tested++;
+        stats->cells_accepted++;
+        stats->interactions++;
+      }
+      return 1;
+    }
+  }
+
+  // stackless walk: opening a node steps into its first child, anything
+  // handled as a whole jumps over its subtree via `next`. Whether a child is
+  // opened was decided together with its siblings when the parent was
+  // opened, and is kept in the parent level's bit mask until then.
+  int open_masks[MAX_LEVEL + 1];
+  vec position_v[Dim];
+  vec theta_v, zero;
+  Real theta_r = (Real)theta_squared;
+  for (int k = 0; k < CHILDREN; k++) {
+    for (int axis = 0; axis < Dim; axis++) {
+      position_v[axis][k] = position[axis];
+    }
+    theta_v[k] = theta_r;
+    zero[k] = 0;
+  }
+
+  int i = 0;
+  int end = (int)nodes.size();
+  while (i < end) {
+    const Node &node = nodes[i];
+    if (i != 0 && !(open_masks[node.level - 1] & (1 << node.child))) {
+      i = node.next;
+      continue;
+    }
+
+    if (count > batch_size - CHILDREN) {
+      calculate_gravity<Dim, Real>(position, batch_axes, batch_stars, count, softening, acceleration);
+      interactions += count;
+      count = 0;
+    }
+
+    if (!node.split) { // leaf holding several stars, opened
+      for (int k = node.first_star; k < node.first_star + node.num_stars; k++) {
+        if (count == batch_size) {
+          calculate_gravity<Dim, Real>(position, batch_axes, batch_stars, count, softening, acceleration);
+          interactions += count;
+          count = 0;
+        }
+        for (int axis = 0; axis < Dim; axis++) {
+          batch[axis][count] = (Real)(Traits::position(stars[order[k]], axis) - origin[axis]);
+        }
+        batch_stars[count] = 1;
+        count++;
+      }
+      if (Count) {
+        stats->direct_stars += node.num_stars;
+      }
+      i = node.next;
+      continue;
+    }
+
+    // opening test s/d > theta for all children at once
+    const ChildBlock<Dim, Real> &block = blocks[node.block];
+    vec size_squared, num;
+    vec d_squared = zero;
+    for (int axis = 0; axis < Dim; axis++) {
+      vec x;
+      memcpy(&x, block.center_of_mass[axis], sizeof(x));
+      vec d = x - position_v[axis];
+      d_squared += d*d;
+    }
+    memcpy(&size_squared, block.size_squared, sizeof(size_squared));
+    memcpy(&num, block.num_stars, sizeof(num));
+    mask open = (size_squared > theta_v*d_squared) & (d_squared > zero) & (num > zero);
+    mask accept = ~open & (num > zero);
+
+    int open_mask = 0;
+    for (int k = 0; k < CHILDREN; k++) {
+      open_mask |= (int)(open[k] & 1) << k;
+      if (accept[k]) {
+        for (int axis = 0; axis < Dim; axis++) {
+          batch[axis][count] = block.center_of_mass[axis][k];
+        }
+        batch_stars[count] = block.num_stars[k];
+        count++;
+      }
+    }
+    open_masks[node.level] = open_mask;
+    if (Count) {
+      stats->nodes_opened++;
+      for (int k = 0; k < CHILDREN; k++) {
+        if (block.num_stars[k] > 1) {
+          stats->cells_tested++;
+          stats->cells_accepted += accept[k] ? 1 : 0;
+        }
+        else if (block.num_stars[k] == 1) {
+          stats->direct_stars++;
+        }
+      }
+    }
+    i++;
+  }
+  calculate_gravity<Dim, Real>(position, batch_axes, batch_stars, count, softening, acceleration);
+  interactions += count;
+  for (int axis = 0; axis < Dim; axis++) {
+    Traits::acceleration(*p, axis) += point_mass*acceleration[axis];
+  }
+  if (Count) {
+    stats->walks++;
+    stats->interactions += interactions;
+  }
+  return interactions;
+}
+
+// Splits the stars into runs of roughly equal total cost (interactions in the
+// previous step), a few per worker. Core stars cost far more than halo stars,
+// so equal sized runs would leave most workers waiting on the core.
+template <int Dim, typename Scalar>
+void SpatialTree<Dim, Scalar>::plan_cost_zones(int num_stars, const int *costs, int num_zones) {
+  zone_bounds.resize(num_zones + 1);
+  long total = 0;
+  for (int i = 0; i < num_stars; i++) {
+    total += costs[i] + 1; // +1 so fresh stars without a cost still spread out
+  }
+  zone_bounds[0] = 0;
+  int zone = 1;
+  long running = 0;
+  for (int i = 0; i < num_stars && zone < num_zones; i++) {
+    running += costs[i] + 1;
+    while (zone < num_zones && running*num_zones >= total*zone) {
+      zone_bounds[zone++] = i + 1;
+    }
+  }
+  while (zone <= num_zones) {
+    zone_bounds[zone++] = num_stars;
+  }
+}
+
+// `costs` (one per star, may be null) holds each star's interaction count
+// from the previous step and is overwritten with this step's counts.
+template <int Dim, typename Scalar>
+void SpatialTree<Dim, Scalar>::update_galaxy(int num_stars, double dt, int *costs, TaskScheduler &scheduler) {
+  // all forces are computed from the same positions before anyone moves
+  update_gravity(num_stars, costs, scheduler);
+  update_motion(num_stars, dt, scheduler);
+}
+
+template <int Dim, typename Scalar>
+void SpatialTree<Dim, Scalar>::update_gravity(int num_stars, int *costs, TaskScheduler &scheduler) {
+  if (collect_stats) {
+    worker_walk_stats.assign(scheduler.num_workers(), WalkStats());
+  }
+  // each chunk counts locally and adds its total to its worker's slot
+  auto walk_range = [&](int begin, int end) {
+    WalkStats local = WalkStats();
+    WalkStats *stats = collect_stats ? &local : nullptr;
+    for (int i = begin; i < end; i++) {
+      for (int axis = 0; axis < Dim; axis++) {
+        Traits::acceleration(stars[i], axis) = 0;
+      }
+      int cost = update_point_gravity(&stars[i], stats);
+      if (costs != nullptr) {
+        costs[i] = cost;
+      }
+    }
+    if (collect_stats) {
+      worker_walk_stats[scheduler.current_worker()].add(local);
+    }
+  };
+
+  if (costs != nullptr && scheduler.num_workers() > 1) {
+    int num_zones = 4*scheduler.num_workers();
+    plan_cost_zones(num_stars, costs, num_zones);
+    auto walk_zones = [&](int begin, int end) {
+      for (int zone = begin; zone < end; zone++) {
+        walk_range(zone_bounds[zone], zone_bounds[zone + 1]);
+      }
+    };
+    scheduler.parallel_for(0, num_zones, 1, walk_zones);
+  }
+  else {
+    scheduler.parallel_for(0, num_stars, 256, walk_range);
+  }
+
+  if (collect_stats) {
+    walk_stats = WalkStats();
+    for (size_t w = 0; w < worker_walk_stats.size(); w++) {
+      walk_stats.add(worker_walk_stats[w]);
+    }
+  }
+}
+
+template <int Dim, typename Scalar>
+void SpatialTree<Dim, Scalar>::update_motion(int num_stars, double dt, TaskScheduler &scheduler) {
+  auto move_stars = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      calculate_motion(&stars[i], dt);
+    }
+  };
+  scheduler.parallel_for(0, num_stars, 4096, move_stars);
+}
+
+template <int Dim, typename Scalar>
+void SpatialTree<Dim, Scalar>::print() {
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i].split) {
+      continue;
+    }
+    for (int k = nodes[i].first_star; k < nodes[i].first_star + nodes[i].num_stars; k++) {
+      for (int axis = 0; axis < Dim; axis++) {
+        std::cout << (axis > 0 ? " " : "") << Traits::position(stars[order[k]], axis);
+      }
+      std::cout << std::endl;
+    }
+  }
+}
+
+// Sorts `keys` with a parallel merge sort: chunks are sorted independently,
+// then merged pairwise, each round of merges running in parallel.
+template <int Dim, typename Scalar>
+void SpatialTree<Dim, Scalar>::sort_keys(TaskScheduler &scheduler) {
+  int n = (int)keys.size();
+  int chunk = std::max(4096, (n + 15)/16);
+  int num_chunks = (n + chunk - 1)/chunk;
+
+  auto sort_chunks = [&](int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      std::sort(keys.begin() + c*chunk, keys.begin() + std::min((c + 1)*chunk, n));
+    }
+  };
+  scheduler.parallel_for(0, num_chunks, 1, sort_chunks);
+
+  sorted_keys.resize(n);
+  for (int width = chunk; width < n; width *= 2) {
+    int num_pairs = (n + 2*width - 1)/(2*width);
+    auto merge_pairs = [&](int begin, int end) {
+      for (int pair = begin; pair < end; pair++) {
+        int lo = pair*2*width;
+        int middle = std::min(lo + width, n);
+        int hi = std::min(lo + 2*width, n);
+        std::merge(keys.begin() + lo, keys.begin() + middle, keys.begin() + middle, keys.begin() + hi, sorted_keys.begin() + lo);
+      }
+    };
+    scheduler.parallel_for(0, num_pairs, 1, merge_pairs);
+    keys.swap(sorted_keys);
+  }
+}
+
+// Tree sizes drift a little from step to step as stars move. Keeping a
+// quarter more capacity than the expected size means steady-state builds
+// reuse their memory instead of growing a vector now and then.
+template <typename T>
+static void reserve_headroom(std::vector<T> &vector, size_t expected) {
+  if (vector.capacity() < expected + expected/4) {
+    vector.reserve(expected + expected/2);
+  }
+}
+
+// Builds the tree from scratch. Stars are sorted by Morton key, so every
+// node covers a contiguous run of `order` and is emitted in depth-first order.
+// With several workers the top of the tree is cut into subtrees that are
+// built in parallel.
+template <int Dim, typename Scalar>
+void SpatialTree<Dim, Scalar>::build(Body *stars, int num_stars, const Scalar *corner, Scalar size, TaskScheduler &scheduler) {
+  this->stars = stars;
+  this->size = size;
+  double key_corner[Dim];
+  for (int axis = 0; axis < Dim; axis++) {
+    this->corner[axis] = corner[axis];
+    origin[axis] = corner[axis] + size/2;
+    key_corner[axis] = corner[axis];
+  }
+
+  keys.resize(num_stars);
+  auto compute_keys = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      double position[Dim];
+      for (int axis = 0; axis < Dim; axis++) {
+        position[axis] = Traits::position(stars[i], axis);
+      }
+      keys[i].first = morton_key(position, key_corner, size);
+      keys[i].second = i;
+    }
+  };
+  {
+    TraceScope trace("Morton Keys");
+    scheduler.parallel_for(0, num_stars, 4096, compute_keys);
+  }
+  {
+    TraceScope trace("Sort Keys");
+    sort_keys(scheduler);
+  }
+  order.resize(num_stars);
+  auto copy_order = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      order[i] = keys[i].second;
+    }
+  };
+  scheduler.parallel_for(0, num_stars, 4096, copy_order);
+
+  // The top of the tree is cut into subtrees that are counted, placed and
+  // then built in parallel straight into `nodes` and `blocks`; the top nodes
+  // are built last, around them. Sizing everything up front keeps a
+  // steady-state build from allocating.
+  num_subtrees = 0;
+  if (num_stars > 0) {
+    int cutoff = scheduler.num_workers() == 1 ? num_stars : std::max(1024, num_stars/(16*scheduler.num_workers()));
+    // every level of the top holds at most num_stars/cutoff nodes, each with up to CHILDREN subtrees
+    subtrees.reserve(CHILDREN*(MAX_LEVEL + 1)*(num_stars/cutoff + 1));
+    plan_subtrees(0, num_stars, 0, 0, corner, size, cutoff);
+
+    auto count_subtrees = [&](int begin, int end) {
+      for (int t = begin; t < end; t++) {
+        Subtree &subtree = subtrees[t];
+        subtree.num_nodes = 0;
+        subtree.num_blocks = 0;
+        count_nodes(subtree.begin, subtree.end, subtree.level, &subtree.num_nodes, &subtree.num_blocks);
+      }
+    };
+    {
+      TraceScope trace("Count Subtrees");
+      scheduler.parallel_for(0, num_subtrees, 1, count_subtrees);
+    }
+
+    int num_nodes = 0;
+    int num_blocks = 0;
+    int cursor = 0;
+    place_subtrees(0, num_stars, 0, &cursor, &num_nodes, &num_blocks);
+    reserve_headroom(nodes, num_nodes);
+    reserve_headroom(blocks, num_blocks);
+    nodes.resize(num_nodes);
+    blocks.resize(num_blocks);
+
+    auto build_subtrees = [&](int begin, int end) {
+      for (int t = begin; t < end; t++) {
+        const Subtree &subtree = subtrees[t];
+        int next_node = subtree.node_offset;
+        int next_block = subtree.block_offset;
+        build_node(subtree.begin, subtree.end, subtree.level, subtree.child, subtree.corner, subtree.size, &next_node, &next_block, nullptr);
+      }
+    };
+    {
+      TraceScope trace("Subtrees");
+      scheduler.parallel_for(0, num_subtrees, 1, build_subtrees);
+    }
+
+    TraceScope trace("Top Nodes");
+    int next_node = 0;
+    int next_block = 0;
+    cursor = 0;
+    build_node(0, num_stars, 0, 0, corner, size, &next_node, &next_block, &cursor);
+  }
+  else {
+    nodes.clear();
+    blocks.clear();
+  }
+
+  for (int axis = 0; axis < Dim; axis++) {
+    center_of_mass[axis] = num_stars > 0 ? nodes[0].center_of_mass[axis] : 0;
+  }
+  this->num_stars = num_stars;
+
+  if (float_forces) {
+    reserve_headroom(blocks_float, blocks.size());
+    blocks_float.resize(blocks.size());
+    // block positions are already relative to the root centre, so they fit a float well
+    auto convert_blocks = [&](int begin, int end) {
+      for (int b = begin; b < end; b++) {
+        for (int k = 0; k < CHILDREN; k++) {
+          for (int axis = 0; axis < Dim; axis++) {
+            blocks_float[b].center_of_mass[axis][k] = (float)blocks[b].center_of_mass[axis][k];
+          }
+          blocks_float[b].size_squared[k] = (float)blocks[b].size_squared[k];
+          blocks_float[b].num_stars[k] = (float)blocks[b].num_stars[k];
+        }
+      }
+    };
+    TraceScope trace("Float Blocks");
+    scheduler.parallel_for(0, (int)blocks.size(), 4096, convert_blocks);
+  }
+
+  if (collect_stats) {
+    compute_tree_stats();
+  }
+}
+
+template <int Dim, typename Scalar>
+void SpatialTree<Dim, Scalar>::compute_tree_stats() {
+  TreeStats stats = TreeStats();
+  long leaf_depths = 0;
+  long leaf_stars = 0;
+  long split_nodes = 0;
+  stats.num_nodes = (int)nodes.size();
+  for (size_t i = 0; i < nodes.size(); i++) {
+    const Node &node = nodes[i];
+    stats.max_depth = std::max(stats.max_depth, (int)node.level);
+    if (node.split) {
+      split_nodes++;
+      continue;
+    }
+    stats.num_leaves++;
+    leaf_depths += node.level;
+    leaf_stars += node.num_stars;
+    stats.max_leaf_stars = std::max(stats.max_leaf_stars, node.num_stars);
+  }
+  if (stats.num_leaves > 0) {
+    stats.mean_leaf_depth = (double)leaf_depths/stats.num_leaves;
+    stats.mean_leaf_stars = (double)leaf_stars/stats.num_leaves;
+  }
+  if (split_nodes > 0) {
+    // every node but the root fills one child slot of its parent
+    stats.child_occupancy = (double)(stats.num_nodes - 1)/(CHILDREN*split_nodes);
+  }
+  stats.memory_bytes = nodes.capacity()*sizeof(Node)
+                     + blocks.capacity()*sizeof(ChildBlock<Dim, double>)
+                     + blocks_float.capacity()*sizeof(ChildBlock<Dim, float>)
+                     + order.capacity()*sizeof(int)
+                     + (keys.capacity() + sorted_keys.capacity())*sizeof(keys[0])
+                     + subtrees.capacity()*sizeof(Subtree);
+  tree_stats = stats;
+}
+
+// end of the run of stars in [begin, end) that fall in the given child; the
+// Dim key bits below this level pick the child, bit `axis` of its index
+// being the upper half along that axis
+template <int Dim, typename Scalar>
+int SpatialTree<Dim, Scalar>::child_end(int begin, int end, int level, int child) {
+  int shift = Dim*(MAX_LEVEL - 1 - level);
+  while (begin < end && (int)((keys[begin].first >> shift) & (CHILDREN - 1)) == child) {
+    begin++;
+  }
+  return begin;
+}
+
+// Walks down the top of the tree and records every node with at most
+// `cutoff` stars as a subtree to build on its own, in depth-first order.
+template <int Dim, typename Scalar>
+void SpatialTree<Dim, Scalar>::plan_subtrees(int begin, int end, int level, int child, const Scalar *corner, Scalar size, int cutoff) {
+  if (end - begin <= cutoff || end - begin <= leaf_capacity || level >= MAX_LEVEL) {
+    if (num_subtrees == (int)subtrees.size()) {
+      subtrees.push_back(Subtree());
+    }
+    Subtree &subtree = subtrees[num_subtrees++];
+    subtree.begin = begin;
+    subtree.end = end;
+    subtree.level = level;
+    subtree.child = child;
+    for (int axis = 0; axis < Dim; axis++) {
+      subtree.corner[axis] = corner[axis];
+    }
+    subtree.size = size;
+    return;
+  }
+  Scalar half = size/2;
+  int begin_of_child = begin;
+  for (int c = 0; c < CHILDREN; c++) {
+    int end_of_child = child_end(begin_of_child, end, level, c);
+    if (end_of_child > begin_of_child) {
+      Scalar child_corner[Dim];
+      for (int axis = 0; axis < Dim; axis++) {
+        child_corner[axis] = corner[axis] + ((c >> axis) & 1)*half;
+      }
+      plan_subtrees(begin_of_child, end_of_child, level + 1, c, child_corner, half, cutoff);
+    }
+    begin_of_child = end_of_child;
+  }
+}
+
+// Counts the nodes and child blocks build_node() emits for stars [begin, end).
+template <int Dim, typename Scalar>
+void SpatialTree<Dim, Scalar>::count_nodes(int begin, int end, int level, int *num_nodes, int *num_blocks) {
+  (*num_nodes)++;
+  if (end - begin <= leaf_capacity || level >= MAX_LEVEL) {
+    return;
+  }
+  (*num_blocks)++;
+  int begin_of_child = begin;
+  for (int c = 0; c < CHILDREN; c++) {
+    int end_of_child = child_end(begin_of_child, end, level, c);
+    if (end_of_child > begin_of_child) {
+      count_nodes(begin_of_child, end_of_child, level + 1, num_nodes, num_blocks);
+    }
+    begin_of_child = end_of_child;
+  }
+}
+
+// Gives every planned subtree the offsets its nodes and blocks will have,
+// following the order build_node() emits them in: nodes before their
+// children, blocks after.
+template <int Dim, typename Scalar>
+void SpatialTree<Dim, Scalar>::place_subtrees(int begin, int end, int level, int *subtree_cursor, int *num_nodes, int *num_blocks) {
+  if (*subtree_cursor < num_subtrees) {
+    Subtree &subtree = subtrees[*subtree_cursor];
+    if (subtree.begin == begin && subtree.end == end && subtree.level == level) {
+      (*subtree_cursor)++;
+      subtree.node_offset = *num_nodes;
+      subtree.block_offset = *num_blocks;
+      *num_nodes += subtree.num_nodes;
+      *num_blocks += subtree.num_blocks;
+      return;
+    }
+  }
+  (*num_nodes)++;
+  if (end - begin <= leaf_capacity || level >= MAX_LEVEL) {
+    return;
+  }
+  int begin_of_child = begin;
+  for (int c = 0; c < CHILDREN; c++) {
+    int end_of_child = child_end(begin_of_child, end, level, c);
+    if (end_of_child > begin_of_child) {
+      place_subtrees(begin_of_child, end_of_child, level + 1, subtree_cursor, num_nodes, num_blocks);
+    }
+    begin_of_child = end_of_child;
+  }
+  (*num_blocks)++;
+}
+
+// Writes the node for stars [begin, end) and everything below it to
+// nodes[*next_node...] and blocks[*next_block...], advancing both. When
+// `subtree_cursor` is given, planned subtrees are already built and are
+// only stepped over.
+template <int Dim, typename Scalar>
+int SpatialTree<Dim, Scalar>::build_node(int begin, int end, int level, int child, const Scalar *corner, Scalar size, int *next_node, int *next_block, int *subtree_cursor) {
+  if (subtree_cursor != nullptr && *subtree_cursor < num_subtrees) {
+    const Subtree &subtree = subtrees[*subtree_cursor];
+    if (subtree.begin == begin && subtree.end == end && subtree.level == level) {
+      (*subtree_cursor)++;
+      *next_node += subtree.num_nodes;
+      *next_block += subtree.num_blocks;
+      return subtree.node_offset;
+    }
+  }
+
+  int index = (*next_node)++;
+  Node node;
+  node.size = size;
+  node.num_stars = end - begin;
+  node.first_star = begin;
+  node.level = level;
+  node.child = child;
+  node.block = -1;
+  node.split = (end - begin > leaf_capacity) && level < MAX_LEVEL;
+
+  if (!node.split) {
+    for (int axis = 0; axis < Dim; axis++) {
+      Scalar sum = 0;
+      for (int k = begin; k < end; k++) {
+        sum += Traits::position(stars[order[k]], axis);
+      }
+      node.center_of_mass[axis] = sum/node.num_stars;
+    }
+  }
+  else {
+    Scalar half = size/2;
+    ChildBlock<Dim, double> block;
+    memset(&block, 0, sizeof(block));
+    Scalar sum[Dim];
+    for (int axis = 0; axis < Dim; axis++) {
+      sum[axis] = 0;
+    }
+    int begin_of_child = begin;
+    for (int c = 0; c < CHILDREN; c++) {
+      int end_of_child = child_end(begin_of_child, end, level, c);
+      if (end_of_child > begin_of_child) {
+        Scalar child_corner[Dim];
+        for (int axis = 0; axis < Dim; axis++) {
+          child_corner[axis] = corner[axis] + ((c >> axis) & 1)*half;
+        }
+        int child_index = build_node(begin_of_child, end_of_child, level + 1, c, child_corner, half, next_node, next_block, subtree_cursor);
+        const Node &n = nodes[child_index];
+        for (int axis = 0; axis < Dim; axis++) {
+          sum[axis] += n.center_of_mass[axis]*n.num_stars;
+          block.center_of_mass[axis][c] = n.center_of_mass[axis] - origin[axis];
+        }
+        block.num_stars[c] = n.num_stars;
+        // a single star is always used exactly, a deepest level leaf is
+        // always opened, a bucket of stars like any other cell
+        if (n.split || (n.num_stars > 1 && n.level < MAX_LEVEL)) {
+          block.size_squared[c] = (double)n.size*n.size;
+        }
+        else {
+          block.size_squared[c] = n.num_stars == 1 ? 0 : INFINITY;
+        }
+      }
+      begin_of_child = end_of_child;
+    }
+    for (int axis = 0; axis < Dim; axis++) {
+      node.center_of_mass[axis] = sum[axis]/node.num_stars;
+    }
+    node.block = (*next_block)++;
+    blocks[node.block] = block;
+  }
+
+  node.next = *next_node;
+  nodes[index] = node;
+  return index;
+}
+
+template class SpatialTree<2, double>;
+template class SpatialTree<3, double>;
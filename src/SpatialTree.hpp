@@ -0,0 +1,182 @@
+#ifndef SPATIAL_TREE_H
+#define SPATIAL_TREE_H
+#include <iostream>
+#include <vector>
+#include <stdint.h>
+#include "Body.hpp"
+#include "TaskScheduler.hpp"
+
+// One node of the flattened tree. Nodes are stored in depth-first order, so
+// a split node's first child is the node right after it and `next` is where
+// the walk continues once the whole subtree has been handled.
+template <int Dim, typename Scalar>
+struct TreeNode{
+  Scalar center_of_mass[Dim];
+  Scalar size;
+  int num_stars;
+  int first_star; // index into SpatialTree::order
+  int next;
+  int block;      // index into SpatialTree::blocks, -1 for leaves
+  short level;
+  short child;    // position among the parent's children
+  bool split;
+};
+
+// N-wide vectors of Real and the masks comparing them gives
+template <typename Real, int N> struct VecTraits;
+template <int N> struct VecTraits<double, N> {
+  typedef double vec __attribute__((vector_size(8*N)));
+  typedef long long mask __attribute__((vector_size(8*N)));
+};
+template <int N> struct VecTraits<float, N> {
+  typedef float vec __attribute__((vector_size(4*N)));
+  typedef int mask __attribute__((vector_size(4*N)));
+};
+
+// The 2^Dim children of a split node side by side (structure of arrays), so
+// the opening test for all of them is a handful of vector operations.
+// Positions are relative to the root centre. Empty children have num_stars == 0.
+template <int Dim, typename Real>
+struct ChildBlock{
+  static const int CHILDREN = 1 << Dim;
+  typedef typename VecTraits<Real, CHILDREN>::vec vec;
+  typedef typename VecTraits<Real, CHILDREN>::mask mask;
+  Real center_of_mass[Dim][CHILDREN];
+  Real size_squared[CHILDREN];
+  Real num_stars[CHILDREN];
+};
+
+// Shape of the most recent tree, gathered in one pass over the nodes.
+struct TreeStats{
+  int num_nodes;
+  int num_leaves;
+  int max_depth;
+  double mean_leaf_depth;
+  double mean_leaf_stars;
+  int max_leaf_stars;     // above leaf_capacity only for leaves at MAX_LEVEL
+  double child_occupancy; // fraction of the child slots of split nodes holding stars
+  long memory_bytes;      // nodes, child blocks, order and sort keys as allocated
+};
+
+// Counters of the force walk, summed over the stars walked.
+struct WalkStats{
+  long walks;
+  long nodes_opened;   // split nodes whose children were tested
+  long cells_tested;   // children holding several stars given the opening test
+  long cells_accepted; // of those, approximated by their centre of mass
+  long direct_stars;   // stars summed one by one
+  long interactions;
+
+  void add(const WalkStats &other) {
+    walks += other.walks;
+    nodes_opened += other.nodes_opened;
+    cells_tested += other.cells_tested;
+    cells_accepted += other.cells_accepted;
+    direct_stars += other.direct_stars;
+    interactions += other.interactions;
+  }
+};
+
+// Barnes-Hut tree over the stars of a Dim dimensional galaxy (a quadtree in
+// 2D, an octree in 3D) with Scalar positions, and the integrator that moves
+// them. Dimension and scalar type are template parameters so the number of
+// children, the Morton key layout and every per-axis and per-child loop are
+// fixed at compile time. Both instantiations of the program, QuadTree and
+// Octree, are compiled in SpatialTree.cpp.
+template <int Dim, typename Scalar>
+class SpatialTree{
+
+public:
+  typedef BodyTraits<Dim, Scalar> Traits;
+  typedef typename Traits::body Body;
+  typedef TreeNode<Dim, Scalar> Node;
+  static const int CHILDREN = 1 << Dim;
+  // deepest level of the tree, one level per bit of a Morton key's axis
+  static const int MAX_LEVEL = 64/Dim;
+
+  Scalar center_of_mass[Dim];
+  double num_stars;
+
+  float theta_threshold;
+  double point_mass;
+  int softening_factor;
+  double softening_squared;
+  double max_speed;
+
+  Scalar corner[Dim]; // lowest corner of the root cell
+  Scalar size;
+  Scalar origin[Dim]; // root centre
+
+  // evaluate forces in single precision (positions still integrate in Scalar)
+  bool float_forces;
+
+  // most stars a leaf holds before it is split; the walk sums a leaf it
+  // opens star by star, so bigger leaves trade depth for direct sums
+  int leaf_capacity;
+
+  // gather tree_stats on every build and walk_stats on every update_gravity;
+  // without it the walk is compiled without its counters
+  bool collect_stats;
+  TreeStats tree_stats;
+  WalkStats walk_stats;
+
+  // stars bounce off walls 10 units inside [0, walls[axis]], set by the
+  // owner; they stay at the window edges, independent of the tree's own box
+  double walls[Dim];
+
+  Body *stars;
+  std::vector<Node> nodes;
+  std::vector<ChildBlock<Dim, double> > blocks;
+  std::vector<ChildBlock<Dim, float> > blocks_float;
+  std::vector<int> order; // star slots sorted by Morton key
+
+public:
+  SpatialTree(float gravity_strength, float max_speed, float theta, int soft_power);
+  static void compute_bounds(Body *stars, int num_stars, TaskScheduler &scheduler, Scalar *corner, Scalar *size);
+  static void reduce_bounds(Body *stars, int begin, int end, Scalar *low, Scalar *high);
+  void set_parameters(float gravity_strength, float max_speed, float theta, int soft_power);
+  void build(Body *stars, int num_stars, const Scalar *corner, Scalar size, TaskScheduler &scheduler);
+  void update_galaxy(int num_stars, double dt, int *costs, TaskScheduler &scheduler);
+  void update_gravity(int num_stars, int *costs, TaskScheduler &scheduler);
+  void update_motion(int num_stars, double dt, TaskScheduler &scheduler);
+  int update_point_gravity(Body *p, WalkStats *stats = nullptr);
+  void compute_tree_stats();
+  void calculate_motion(Body *p, double dt);
+  void print();
+
+private:
+  // a piece of the tree below the top levels, built by one task
+  struct Subtree{
+    int begin;
+    int end;
+    int level;
+    int child;
+    Scalar corner[Dim];
+    Scalar size;
+    int num_nodes;
+    int num_blocks;
+    int node_offset;  // where its nodes and blocks land in the full tree
+    int block_offset;
+  };
+
+  std::vector<std::pair<uint64_t, int> > keys;
+  std::vector<std::pair<uint64_t, int> > sorted_keys;
+  std::vector<Subtree> subtrees;
+  int num_subtrees;
+
+  std::vector<int> zone_bounds;
+  std::vector<WalkStats> worker_walk_stats; // one per worker, summed into walk_stats
+
+  template <typename Real, bool Count> int walk(Body *p, const std::vector<ChildBlock<Dim, Real> > &blocks, WalkStats *stats);
+  void plan_cost_zones(int num_stars, const int *costs, int num_zones);
+  void sort_keys(TaskScheduler &scheduler);
+  int child_end(int begin, int end, int level, int child);
+  void plan_subtrees(int begin, int end, int level, int child, const Scalar *corner, Scalar size, int cutoff);
+  void count_nodes(int begin, int end, int level, int *num_nodes, int *num_blocks);
+  void place_subtrees(int begin, int end, int level, int *subtree_cursor, int *num_nodes, int *num_blocks);
+  int build_node(int begin, int end, int level, int child, const Scalar *corner, Scalar size, int *next_node, int *next_block, int *subtree_cursor);
+};
+
+typedef SpatialTree<2, double> QuadTree;
+typedef SpatialTree<3, double> Octree;
+#endif
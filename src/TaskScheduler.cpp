@@ -0,0 +1,254 @@
+#include "TaskScheduler.hpp"
+#include "Tracer.hpp"
+#include <algorithm>
+#include <chrono>
+
+// the scheduler that started this thread, and the thread's index in it
+static thread_local const TaskScheduler *worker_owner = nullptr;
+static thread_local int worker_index = 0;
+static thread_local bool inside_task = false;
+
+// how many idle polls a worker makes before parking on the condition variable
+const int SPIN_LIMIT = 4000;
+
+WorkDeque::WorkDeque() {
+  top.store(0);
+  bottom.store(0);
+}
+
+bool WorkDeque::push(uint64_t range) {
+  long b = bottom.load(std::memory_order_relaxed);
+  long t = top.load(std::memory_order_acquire);
+  if (b - t >= CAPACITY) {
+    return false;
+  }
+  buffer[b % CAPACITY].store(range, std::memory_order_relaxed);
+  bottom.store(b + 1, std::memory_order_release);
+  return true;
+}
+
+bool WorkDeque::pop(uint64_t *range) {
+  long b = bottom.load(std::memory_order_relaxed) - 1;
+  bottom.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  long t = top.load(std::memory_order_relaxed);
+  if (t > b) { // empty
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return false;
+  }
+  *range = buffer[b % CAPACITY].load(std::memory_order_relaxed);
+  if (t == b) { // last item, race any thief for it
+    bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return won;
+  }
+  return true;
+}
+
+bool WorkDeque::steal(uint64_t *range) {
+  long t = top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  long b = bottom.load(std::memory_order_acquire);
+  if (t >= b) {
+    return false;
+  }
+  *range = buffer[t % CAPACITY].load(std::memory_order_relaxed);
+  return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+static uint64_t pack_range(int begin, int end) {
+  return ((uint64_t)(uint32_t)begin << 32) | (uint32_t)end;
+}
+
+TaskScheduler::TaskScheduler(int num_workers) {
+  job.fn = nullptr;
+  job.context = nullptr;
+  job.grain = 1;
+  job.label = nullptr;
+  job.remaining.store(0);
+  epoch.store(0);
+  stopping = false;
+  start_workers(num_workers);
+}
+
+TaskScheduler::~TaskScheduler() {
+  stop_workers();
+}
+
+int TaskScheduler::num_workers() const {
+  return (int)workers.size();
+}
+
+int TaskScheduler::current_worker() const {
+  return worker_owner == this ? worker_index : 0;
+}
+
+int TaskScheduler::thread_worker() {
+  return worker_index;
+}
+
+void TaskScheduler::set_num_workers(int num_workers) {
+  if (num_workers == this->num_workers()) {
+    return;
+  }
+  stop_workers();
+  start_workers(num_workers);
+}
+
+void TaskScheduler::start_workers(int num_workers) {
+  num_workers = std::max(1, num_workers);
+  stopping = false;
+  for (int i = 0; i < num_workers; i++) {
+    Worker *worker = new Worker();
+    worker->tasks.store(0);
+    worker->steals.store(0);
+    worker->busy_ns.store(0);
+    worker->random_state = 2463534242u + i*7919;
+    workers.push_back(worker);
+  }
+  for (int i = 1; i < num_workers; i++) {
+    threads.push_back(std::thread(&TaskScheduler::worker_loop, this, i));
+  }
+}
+
+void TaskScheduler::stop_workers() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+  threads.clear();
+  for (size_t i = 0; i < workers.size(); i++) {
+    delete workers[i];
+  }
+  workers.clear();
+}
+
+void TaskScheduler::take_stats(std::vector<WorkerStats> &stats) {
+  stats.resize(workers.size());
+  for (size_t i = 0; i < workers.size(); i++) {
+    stats[i].tasks = workers[i]->tasks.exchange(0, std::memory_order_relaxed);
+    stats[i].steals = workers[i]->steals.exchange(0, std::memory_order_relaxed);
+    stats[i].busy_ms = workers[i]->busy_ns.exchange(0, std::memory_order_relaxed)/1e6;
+  }
+}
+
+void TaskScheduler::run(int begin, int end, int grain, void (*fn)(void *, int, int), void *context) {
+  if (end <= begin) {
+    return;
+  }
+  grain = std::max(1, grain);
+  if (inside_task || workers.size() == 1 || end - begin <= grain) {
+    for (int lo = begin; lo < end; lo += grain) {
+      fn(context, lo, std::min(lo + grain, end));
+    }
+    return;
+  }
+
+  job.fn = fn;
+  job.context = context;
+  job.grain = grain;
+  job.label = Tracer::label();
+  job.remaining.store(end - begin, std::memory_order_release);
+  workers[0]->deque.push(pack_range(begin, end));
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    epoch.fetch_add(1);
+  }
+  wake.notify_all();
+
+  work_until_done(0);
+}
+
+void TaskScheduler::worker_loop(int index) {
+  worker_owner = this;
+  worker_index = index;
+  long seen_epoch = 0;
+  while (true) {
+    // spin a little first, phases of one step follow each other closely
+    for (int spin = 0; spin < SPIN_LIMIT && epoch.load(std::memory_order_acquire) == seen_epoch; spin++) {
+      std::this_thread::yield();
+    }
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (!stopping && epoch.load() == seen_epoch) {
+        wake.wait(lock);
+      }
+      if (stopping) {
+        return;
+      }
+      seen_epoch = epoch.load();
+    }
+    work_until_done(index);
+  }
+}
+
+void TaskScheduler::work_until_done(int index) {
+  uint64_t range;
+  while (job.remaining.load(std::memory_order_acquire) > 0) {
+    if (find_work(index, &range)) {
+      execute(index, range);
+    }
+    else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+bool TaskScheduler::find_work(int index, uint64_t *range) {
+  Worker *self = workers[index];
+  if (self->deque.pop(range)) {
+    return true;
+  }
+  int n = (int)workers.size();
+  for (int attempt = 0; attempt < n; attempt++) {
+    // xorshift to pick victims in a different order on every worker
+    uint32_t x = self->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    self->random_state = x;
+    int victim = x % n;
+    if (victim != index && workers[victim]->deque.steal(range)) {
+      self->steals.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+void TaskScheduler::execute(int index, uint64_t range) {
+  Worker *self = workers[index];
+  int begin = (int)(range >> 32);
+  int end = (int)(uint32_t)range;
+  // keep splitting in half, leaving the upper halves for thieves
+  while (end - begin > job.grain) {
+    int middle = begin + (end - begin)/2;
+    if (!self->deque.push(pack_range(middle, end))) {
+      break;
+    }
+    end = middle;
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  inside_task = true;
+  for (int lo = begin; lo < end; lo += job.grain) {
+    job.fn(job.context, lo, std::min(lo + job.grain, end));
+  }
+  inside_task = false;
+  std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+  uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+  if (Tracer::enabled()) {
+    Tracer::record(job.label,
+                   std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count(),
+                   std::chrono::duration_cast<std::chrono::nanoseconds>(stop.time_since_epoch()).count(),
+                   begin, end);
+  }
+
+  self->busy_ns.fetch_add(elapsed, std::memory_order_relaxed);
+  self->tasks.fetch_add(1, std::memory_order_relaxed);
+  job.remaining.fetch_sub(end - begin, std::memory_order_acq_rel);
+}
@@ -0,0 +1,104 @@
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+// Chase-Lev work-stealing deque of index ranges. The owning worker pushes
+// and pops at the bottom, other workers steal from the top. Ranges are
+// packed as (begin << 32 | end) so every slot is a single atomic word.
+class WorkDeque{
+
+public:
+  static const int CAPACITY = 256;
+
+  WorkDeque();
+  bool push(uint64_t range);
+  bool pop(uint64_t *range);
+  bool steal(uint64_t *range);
+
+private:
+  std::atomic<long> top;
+  std::atomic<long> bottom;
+  std::atomic<uint64_t> buffer[CAPACITY];
+};
+
+// Per-worker counters, reset every time they are read with take_stats().
+struct WorkerStats{
+  uint64_t tasks;
+  uint64_t steals;
+  double busy_ms;
+};
+
+// Persistent pool of workers shared by every phase of a step. The thread
+// calling parallel_for() is worker 0 and works alongside the others; idle
+// workers spin briefly and then park until the next parallel_for().
+class TaskScheduler{
+
+public:
+  TaskScheduler(int num_workers);
+  ~TaskScheduler();
+  int num_workers() const;
+  void set_num_workers(int num_workers);
+  void take_stats(std::vector<WorkerStats> &stats);
+
+  // index of the calling thread among this scheduler's workers; 0 for any
+  // other thread, such as the one calling parallel_for() or a worker of
+  // another scheduler running this one's tasks inline
+  int current_worker() const;
+  // index of the calling thread in the scheduler that started it, 0 for
+  // threads no scheduler started
+  static int thread_worker();
+
+  // Calls fn(begin, end) on disjoint sub-ranges of at most `grain` items
+  // covering [begin, end). Calls made from inside a task, or with a single
+  // worker, simply run on the calling thread.
+  template <typename F>
+  void parallel_for(int begin, int end, int grain, F &fn) {
+    run(begin, end, grain, &invoke<F>, &fn);
+  }
+
+private:
+  struct Worker{
+    WorkDeque deque;
+    std::atomic<uint64_t> tasks;
+    std::atomic<uint64_t> steals;
+    std::atomic<uint64_t> busy_ns;
+    uint32_t random_state;
+    char padding[64]; // keeps neighbouring workers' counters off this cache line
+  };
+
+  // the one job in flight; phases run one after another so one slot is enough
+  struct Job{
+    void (*fn)(void *context, int begin, int end);
+    void *context;
+    int grain;
+    const char *label; // trace name of the tasks, taken from the caller's scope
+    std::atomic<long> remaining;
+  };
+
+  template <typename F>
+  static void invoke(void *context, int begin, int end) {
+    (*(F *)context)(begin, end);
+  }
+
+  void run(int begin, int end, int grain, void (*fn)(void *, int, int), void *context);
+  void start_workers(int num_workers);
+  void stop_workers();
+  void worker_loop(int index);
+  void work_until_done(int index);
+  bool find_work(int index, uint64_t *range);
+  void execute(int index, uint64_t range);
+
+  std::vector<Worker *> workers;
+  std::vector<std::thread> threads;
+  Job job;
+  std::atomic<long> epoch;
+  bool stopping;
+  std::mutex mutex;
+  std::condition_variable wake;
+};
+#endif
@@ -0,0 +1,73 @@
+#include "ThetaController.hpp"
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+const char *theta_mode_names[THETA_MODE_COUNT] = {"off", "step-time", "force-error"};
+
+// weight of the newest step time in the smoothed one
+const double SMOOTHING = 0.3;
+// fraction of the estimated correction made in one update
+const double GAIN = 0.5;
+// largest change of theta per step
+const double MAX_CHANGE = 1.05;
+
+// theta's scale factor for a measurement `ratio` times the target, within
+// [1/max_change, max_change]
+static double correction(double ratio, double hysteresis, double max_change) {
+  double factor = std::fabs(ratio - 1) > hysteresis ? std::pow(ratio, 0.5*GAIN) : 1;
+  return std::min(max_change, std::max(1/max_change, factor));
+}
+
+int find_theta_mode(const char *name) {
+  for (int mode = 0; mode < THETA_MODE_COUNT; mode++) {
+    if (strcmp(name, theta_mode_names[mode]) == 0) {
+      return mode;
+    }
+  }
+  return -1;
+}
+
+ThetaController::ThetaController() {
+  mode = THETA_FIXED;
+  target_ms = 10;
+  target_error = 0.01;
+  min_theta = 0.3f;
+  max_theta = 2.0f;
+  hysteresis = 0.1;
+  sample_interval = 10;
+  step_ms = 0;
+  force_error = 0;
+  interactions = 0;
+  new_sample = false;
+  sample_factor = 1;
+  sample_steps_left = 0;
+}
+
+float ThetaController::update(float theta, double step_ms) {
+  this->step_ms = this->step_ms > 0 ? SMOOTHING*step_ms + (1 - SMOOTHING)*this->step_ms : step_ms;
+  // the ratios are how many times too slow or too accurate
+  double factor = 1;
+  if (mode == THETA_STEP_TIME) {
+    factor = correction(this->step_ms/target_ms, hysteresis, MAX_CHANGE);
+  }
+  else if (mode == THETA_FORCE_ERROR) {
+    // each sample is acted on once, the next shows what that did; the
+    // change is spread evenly over the steps until then
+    if (new_sample && force_error > 0) {
+      new_sample = false;
+      int steps = std::max(1, sample_interval);
+      sample_factor = std::pow(correction(target_error/force_error, hysteresis, std::pow(MAX_CHANGE, steps)), 1.0/steps);
+      sample_steps_left = steps;
+    }
+    if (sample_steps_left > 0) {
+      factor = sample_factor;
+      sample_steps_left--;
+    }
+  }
+  else {
+    return theta;
+  }
+  float low = std::max(0.05f, std::min(min_theta, max_theta));
+  return std::min(std::max(low, max_theta), std::max(low, (float)(theta*factor)));
+}
@@ -0,0 +1,42 @@
+#ifndef THETA_CONTROLLER_H
+#define THETA_CONTROLLER_H
+
+enum ThetaMode {
+  THETA_FIXED,       // theta stays where it is set
+  THETA_STEP_TIME,   // hold the time of a simulation step
+  THETA_FORCE_ERROR, // hold the median force error of a sample of stars
+  THETA_MODE_COUNT
+};
+
+extern const char *theta_mode_names[THETA_MODE_COUNT];
+// the mode called `name` (as in theta_mode_names), -1 if there is none
+int find_theta_mode(const char *name);
+
+// Moves theta a little after every step towards a step time or force error
+// target. Step time falls and force error grows roughly with theta squared,
+// so each update scales theta by a damped square root of how far the
+// measurement is off, and leaves it alone within the hysteresis band.
+struct ThetaController{
+  int mode;
+  double target_ms;     // THETA_STEP_TIME
+  double target_error;  // THETA_FORCE_ERROR, median relative error
+  float min_theta;
+  float max_theta;
+  double hysteresis;    // relative miss of the target that is left alone
+  int sample_interval;  // steps between force error samples
+
+  // measurements, the step time smoothed over a few steps
+  double step_ms;
+  double force_error;   // of the last sample, 0 before the first
+  double interactions;  // per sampled star
+  bool new_sample;
+
+  // force error: the last sample's change, made a step at a time
+  double sample_factor;
+  int sample_steps_left;
+
+  ThetaController();
+  // the theta for the next step, given the time this one took
+  float update(float theta, double step_ms);
+};
+#endif
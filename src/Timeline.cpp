@@ -0,0 +1,82 @@
+#include "Timeline.hpp"
+#include <string.h>
+
+const char *parameter_names[PARAM_COUNT] = {"solver", "gravity", "max_speed", "theta", "softening", "float_forces", "cost_zones", "reorder_interval"};
+
+int find_parameter(const char *name) {
+  for (int parameter = 0; parameter < PARAM_COUNT; parameter++) {
+    if (strcmp(name, parameter_names[parameter]) == 0) {
+      return parameter;
+    }
+  }
+  return -1;
+}
+
+double get_parameter(const Galaxy &galaxy, int parameter) {
+  switch (parameter) {
+    case PARAM_SOLVER: return galaxy.solver;
+    case PARAM_GRAVITY: return galaxy.gravity_strength;
+    case PARAM_MAX_SPEED: return galaxy.max_speed;
+    case PARAM_THETA: return galaxy.theta;
+    case PARAM_SOFTENING: return galaxy.soft_power;
+    case PARAM_FLOAT_FORCES: return galaxy.float_forces;
+    case PARAM_COST_ZONES: return galaxy.cost_zones;
+    case PARAM_REORDER_INTERVAL: return galaxy.reorder_interval;
+  }
+  return 0;
+}
+
+void set_parameter(Galaxy &galaxy, int parameter, double value) {
+  switch (parameter) {
+    case PARAM_SOLVER: galaxy.solver = (int)value; break;
+    case PARAM_GRAVITY: galaxy.gravity_strength = (float)value; break;
+    case PARAM_MAX_SPEED: galaxy.max_speed = (float)value; break;
+    case PARAM_THETA: galaxy.theta = (float)value; break;
+    case PARAM_SOFTENING: galaxy.soft_power = (int)value; break;
+    case PARAM_FLOAT_FORCES: galaxy.float_forces = value != 0; break;
+    case PARAM_COST_ZONES: galaxy.cost_zones = value != 0; break;
+    case PARAM_REORDER_INTERVAL: galaxy.reorder_interval = (int)value; break;
+  }
+}
+
+Timeline::Timeline() {
+  next_change = 0;
+  have_recorded = false;
+}
+
+void Timeline::add(long step, int parameter, double value) {
+  ParameterChange change = {step, parameter, value};
+  // almost always the newest, scenario files are the exception
+  size_t position = changes.size();
+  while (position > 0 && changes[position - 1].step > step) {
+    position--;
+  }
+  changes.insert(changes.begin() + position, change);
+}
+
+void Timeline::rewind() {
+  next_change = 0;
+}
+
+int Timeline::apply(Galaxy &galaxy) {
+  int applied = 0;
+  while (next_change < changes.size() && changes[next_change].step <= galaxy.step_number) {
+    set_parameter(galaxy, changes[next_change].parameter, changes[next_change].value);
+    next_change++;
+    applied++;
+  }
+  return applied;
+}
+
+void Timeline::record(const Galaxy &galaxy) {
+  for (int parameter = 0; parameter < PARAM_COUNT; parameter++) {
+    double value = get_parameter(galaxy, parameter);
+    // an adaptive theta moves by itself, and will again on replay
+    bool adapted = parameter == PARAM_THETA && galaxy.theta_controller.mode != THETA_FIXED;
+    if (have_recorded && value != recorded[parameter] && !adapted) {
+      add(galaxy.step_number, parameter, value);
+    }
+    recorded[parameter] = value;
+  }
+  have_recorded = true;
+}
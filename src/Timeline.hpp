@@ -0,0 +1,54 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+#include <vector>
+#include "Galaxy.hpp"
+
+// the galaxy's tunables, named as in a scenario's [physics] section
+enum Parameter {
+  PARAM_SOLVER,
+  PARAM_GRAVITY,
+  PARAM_MAX_SPEED,
+  PARAM_THETA,
+  PARAM_SOFTENING,
+  PARAM_FLOAT_FORCES,
+  PARAM_COST_ZONES,
+  PARAM_REORDER_INTERVAL,
+  PARAM_COUNT
+};
+
+extern const char *parameter_names[PARAM_COUNT];
+// the parameter called `name`, -1 if there is none; the solver's value is
+// its SolverKind
+int find_parameter(const char *name);
+double get_parameter(const Galaxy &galaxy, int parameter);
+void set_parameter(Galaxy &galaxy, int parameter, double value);
+
+// a tunable set to `value` before the galaxy steps on from `step`
+struct ParameterChange{
+  long step;
+  int parameter;
+  double value;
+};
+
+// Parameter changes by step number, so a session of slider dragging can be
+// recorded and stepped through again, in the window or headless.
+struct Timeline{
+  std::vector<ParameterChange> changes; // by step, then in the order made
+  size_t next_change;                   // the first one apply has not reached
+
+  Timeline();
+  void add(long step, int parameter, double value);
+  // plays the changes from the start again
+  void rewind();
+  // sets every change up to the galaxy's step, returns how many it set
+  int apply(Galaxy &galaxy);
+  // Adds a change at the galaxy's step for each tunable that differs from
+  // the last call; the first call only takes note of the values. Theta is
+  // left out while the galaxy adapts it.
+  void record(const Galaxy &galaxy);
+
+private:
+  double recorded[PARAM_COUNT];
+  bool have_recorded;
+};
+#endif
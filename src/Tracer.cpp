@@ -0,0 +1,165 @@
+#include "Tracer.hpp"
+#include "TaskScheduler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+
+struct TraceEvent{
+  const char *name;
+  int64_t start_ns;
+  int64_t end_ns;
+  int begin; // task range, begin < 0 for phases
+  int end;
+};
+
+struct TraceBuffer{
+  TraceEvent *events;
+  std::atomic<int> count;
+  std::atomic<int> dropped;
+  int worker;
+};
+
+const int Tracer::MAX_THREADS;
+const int Tracer::CAPACITY;
+std::atomic<bool> Tracer::recording(false);
+
+static std::atomic<TraceBuffer *> buffers[Tracer::MAX_THREADS];
+static std::atomic<int> num_buffers(0);
+static std::atomic<long> lost_threads(0);
+static int64_t trace_start_ns = 0;
+
+static thread_local TraceBuffer *local_buffer = nullptr;
+static thread_local bool buffer_refused = false;
+static thread_local const char *current_label = "Task";
+
+// Buffers are handed out once per thread and never freed, so a thread that
+// exits (e.g. when the worker count changes) leaves its events behind to be
+// written out with the rest.
+static TraceBuffer *thread_buffer() {
+  if (local_buffer != nullptr || buffer_refused) {
+    return local_buffer;
+  }
+  int slot = num_buffers.fetch_add(1);
+  if (slot >= Tracer::MAX_THREADS) {
+    buffer_refused = true;
+    lost_threads.fetch_add(1);
+    return nullptr;
+  }
+  TraceBuffer *buffer = new TraceBuffer();
+  buffer->events = new TraceEvent[Tracer::CAPACITY];
+  buffer->count.store(0);
+  buffer->dropped.store(0);
+  buffer->worker = TaskScheduler::thread_worker();
+  buffers[slot].store(buffer, std::memory_order_release);
+  local_buffer = buffer;
+  return buffer;
+}
+
+int64_t Tracer::now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::start() {
+  int n = std::min(num_buffers.load(), MAX_THREADS);
+  for (int i = 0; i < n; i++) {
+    TraceBuffer *buffer = buffers[i].load(std::memory_order_acquire);
+    if (buffer != nullptr) {
+      buffer->count.store(0, std::memory_order_relaxed);
+      buffer->dropped.store(0, std::memory_order_relaxed);
+    }
+  }
+  lost_threads.store(0);
+  trace_start_ns = now_ns();
+  recording.store(true, std::memory_order_release);
+}
+
+void Tracer::stop() {
+  recording.store(false, std::memory_order_release);
+}
+
+void Tracer::record(const char *name, int64_t start_ns, int64_t end_ns, int begin, int end) {
+  if (!enabled()) {
+    return;
+  }
+  TraceBuffer *buffer = thread_buffer();
+  if (buffer == nullptr) {
+    return;
+  }
+  // only this thread writes the buffer; the release store publishes the event
+  int index = buffer->count.load(std::memory_order_relaxed);
+  if (index >= CAPACITY) {
+    buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  TraceEvent &event = buffer->events[index];
+  event.name = name;
+  event.start_ns = start_ns;
+  event.end_ns = end_ns;
+  event.begin = begin;
+  event.end = end;
+  buffer->count.store(index + 1, std::memory_order_release);
+}
+
+const char *Tracer::label() {
+  return current_label;
+}
+
+long Tracer::write(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == nullptr) {
+    return -1;
+  }
+  long num_events = 0;
+  long num_dropped = 0;
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"StarSwift\"}}");
+  int n = std::min(num_buffers.load(), MAX_THREADS);
+  for (int tid = 0; tid < n; tid++) {
+    TraceBuffer *buffer = buffers[tid].load(std::memory_order_acquire);
+    if (buffer == nullptr) {
+      continue;
+    }
+    int count = buffer->count.load(std::memory_order_acquire);
+    if (count == 0) {
+      continue;
+    }
+    num_dropped += buffer->dropped.load(std::memory_order_relaxed);
+    fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Worker %d\"}}", tid, buffer->worker);
+    fprintf(file, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"sort_index\":%d}}", tid, buffer->worker);
+    for (int i = 0; i < count; i++) {
+      const TraceEvent &event = buffer->events[i];
+      double ts = (event.start_ns - trace_start_ns)/1e3;
+      double dur = (event.end_ns - event.start_ns)/1e3;
+      if (event.begin < 0) {
+        fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                event.name, tid, ts, dur);
+      }
+      else {
+        fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"task\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"begin\":%d,\"end\":%d}}",
+                event.name, tid, ts, dur, event.begin, event.end);
+      }
+      num_events++;
+    }
+  }
+  fprintf(file, "\n]}\n");
+  bool ok = ferror(file) == 0;
+  ok = fclose(file) == 0 && ok;
+  if (num_dropped > 0 || lost_threads.load() > 0) {
+    fprintf(stderr, "trace: dropped %ld events, %ld threads had no buffer\n", num_dropped, lost_threads.load());
+  }
+  return ok ? num_events : -1;
+}
+
+TraceScope::TraceScope(const char *name) {
+  this->name = name;
+  previous = current_label;
+  current_label = name;
+  start = Tracer::enabled() ? Tracer::now_ns() : 0;
+}
+
+TraceScope::~TraceScope() {
+  current_label = previous;
+  if (start != 0) {
+    Tracer::record(name, start, Tracer::now_ns());
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef TRACER_H
+#define TRACER_H
+#include <atomic>
+#include <stdint.h>
+
+// Opt-in timeline of phase and task events, written out as Chrome trace
+// JSON for chrome://tracing or ui.perfetto.dev. Every thread appends to a
+// buffer of its own, so recording takes no locks; events past a buffer's
+// capacity are dropped and counted.
+class Tracer{
+
+public:
+  static const int MAX_THREADS = 256;
+  static const int CAPACITY = 1 << 18; // events per thread
+
+  // clears all buffers and starts recording; call while no tasks are running
+  static void start();
+  static void stop();
+  static bool enabled() {
+    return recording.load(std::memory_order_relaxed);
+  }
+  // writes everything recorded since start(), returns the event count or -1
+  static long write(const char *path);
+
+  // name must be a string literal or otherwise outlive the trace; tasks pass
+  // the index range they covered
+  static void record(const char *name, int64_t start_ns, int64_t end_ns, int begin = -1, int end = -1);
+  static int64_t now_ns();
+
+  // name of the innermost TraceScope on this thread, tasks are named after it
+  static const char *label();
+
+private:
+  static std::atomic<bool> recording;
+};
+
+// Records its scope as one event while tracing, and names the tasks of any
+// parallel_for called inside it.
+class TraceScope{
+
+public:
+  TraceScope(const char *name);
+  ~TraceScope();
+
+private:
+  const char *name;
+  const char *previous;
+  int64_t start;
+};
+#endif
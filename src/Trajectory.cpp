@@ -0,0 +1,495 @@
+#include "Trajectory.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+
+static_assert(sizeof(TrajectoryHeader) == 32, "trajectory header layout changed, bump TRAJECTORY_VERSION");
+static_assert(sizeof(TrajectoryFrameHeader) == 56, "frame header layout changed, bump TRAJECTORY_VERSION");
+
+static void set_message(std::string *error, const std::string &message) {
+  if (error != nullptr) {
+    *error = message;
+  }
+}
+
+static uint32_t quantize(double value, double origin, double scale, uint32_t max_q) {
+  double q = (value - origin)*scale + 0.5;
+  if (!(q > 0)) { // also catches NaN
+    return 0;
+  }
+  return q >= max_q ? max_q : (uint32_t)q;
+}
+
+static double dequantize(uint32_t q, double origin, double step) {
+  return origin + q*step;
+}
+
+static int bit_width(uint64_t value) {
+  int width = 0;
+  while (value != 0) {
+    value >>= 1;
+    width++;
+  }
+  return width;
+}
+
+// Bits are packed least significant first into a little-endian byte stream.
+class BitWriter{
+
+public:
+  BitWriter(std::vector<uint8_t> &out) : out(out) {
+    bits = 0;
+    count = 0;
+  }
+
+  void put(uint64_t value, int width) {
+    bits |= value << count;
+    count += width;
+    while (count >= 8) {
+      out.push_back((uint8_t)bits);
+      bits >>= 8;
+      count -= 8;
+    }
+  }
+
+  void flush() {
+    if (count > 0) {
+      out.push_back((uint8_t)bits);
+    }
+    bits = 0;
+    count = 0;
+  }
+
+private:
+  std::vector<uint8_t> &out;
+  uint64_t bits;
+  int count;
+};
+
+class BitReader{
+
+public:
+  BitReader(const uint8_t *in) {
+    this->in = in;
+    bits = 0;
+    count = 0;
+  }
+
+  uint64_t get(int width) {
+    while (count < width) {
+      bits |= (uint64_t)*in++ << count;
+      count += 8;
+    }
+    uint64_t value = bits & (((uint64_t)1 << width) - 1);
+    bits >>= width;
+    count -= width;
+    return value;
+  }
+
+private:
+  const uint8_t *in;
+  uint64_t bits;
+  int count;
+};
+
+void TrajectoryCodec::reset(int num_stars, int bits) {
+  this->num_stars = num_stars;
+  this->bits = bits;
+  have_previous = false;
+  previous_x0 = 0;
+  previous_y0 = 0;
+  previous_size = 1;
+  quantized_x.assign(num_stars, 0);
+  quantized_y.assign(num_stars, 0);
+  predicted.assign(num_stars, 0);
+  residuals.assign(TRAJECTORY_BLOCK, 0);
+}
+
+// the previous frame's positions as this frame would have quantized them
+void TrajectoryCodec::predict(const std::vector<uint32_t> &previous, double previous_origin, double origin, const TrajectoryFrameHeader &frame) {
+  uint32_t max_q = ((uint32_t)1 << bits) - 1;
+  if (frame.keyframe || !have_previous) {
+    std::fill(predicted.begin(), predicted.end(), 0);
+    return;
+  }
+  double previous_step = previous_size/max_q;
+  double scale = max_q/frame.size;
+  for (int i = 0; i < num_stars; i++) {
+    predicted[i] = quantize(dequantize(previous[i], previous_origin, previous_step), origin, scale, max_q);
+  }
+}
+
+void TrajectoryCodec::encode(const double *x, const double *y, const TrajectoryFrameHeader &frame, std::vector<uint8_t> &out) {
+  uint32_t max_q = ((uint32_t)1 << bits) - 1;
+  double scale = max_q/frame.size;
+  int num_blocks = (num_stars + TRAJECTORY_BLOCK - 1)/TRAJECTORY_BLOCK;
+  size_t widths = out.size();
+  out.resize(widths + 2*num_blocks);
+  BitWriter writer(out);
+
+  for (int axis = 0; axis < 2; axis++) {
+    const double *values = axis == 0 ? x : y;
+    std::vector<uint32_t> &quantized = axis == 0 ? quantized_x : quantized_y;
+    double origin = axis == 0 ? frame.x0 : frame.y0;
+    predict(quantized, axis == 0 ? previous_x0 : previous_y0, origin, frame);
+
+    for (int block = 0; block < num_blocks; block++) {
+      int begin = block*TRAJECTORY_BLOCK;
+      int end = std::min(begin + TRAJECTORY_BLOCK, num_stars);
+      uint64_t largest = 0;
+      for (int i = begin; i < end; i++) {
+        quantized[i] = quantize(values[i], origin, scale, max_q);
+        int64_t residual = (int64_t)quantized[i] - (int64_t)predicted[i];
+        uint64_t zigzag = ((uint64_t)residual << 1) ^ (uint64_t)(residual >> 63);
+        residuals[i - begin] = zigzag;
+        largest |= zigzag;
+      }
+      int width = bit_width(largest);
+      out[widths + axis*num_blocks + block] = (uint8_t)width;
+      for (int i = begin; i < end; i++) {
+        writer.put(residuals[i - begin], width);
+      }
+    }
+  }
+  writer.flush();
+  // lets the reader fetch whole bytes past the last value, and keeps the
+  // next frame header 8 byte aligned
+  size_t padded = (out.size() - widths + 8 + 7) & ~(size_t)7;
+  out.resize(widths + padded, 0);
+
+  have_previous = true;
+  previous_x0 = frame.x0;
+  previous_y0 = frame.y0;
+  previous_size = frame.size;
+}
+
+void TrajectoryCodec::decode(const uint8_t *payload, const TrajectoryFrameHeader &frame, double *x, double *y) {
+  uint32_t max_q = ((uint32_t)1 << bits) - 1;
+  double step = frame.size/max_q;
+  int num_blocks = (num_stars + TRAJECTORY_BLOCK - 1)/TRAJECTORY_BLOCK;
+  BitReader reader(payload + 2*num_blocks);
+
+  for (int axis = 0; axis < 2; axis++) {
+    double *values = axis == 0 ? x : y;
+    std::vector<uint32_t> &quantized = axis == 0 ? quantized_x : quantized_y;
+    double origin = axis == 0 ? frame.x0 : frame.y0;
+    predict(quantized, axis == 0 ? previous_x0 : previous_y0, origin, frame);
+
+    for (int block = 0; block < num_blocks; block++) {
+      int begin = block*TRAJECTORY_BLOCK;
+      int end = std::min(begin + TRAJECTORY_BLOCK, num_stars);
+      int width = payload[axis*num_blocks + block];
+      for (int i = begin; i < end; i++) {
+        uint64_t zigzag = reader.get(width);
+        int64_t residual = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+        quantized[i] = (uint32_t)((int64_t)predicted[i] + residual);
+        values[i] = dequantize(quantized[i], origin, step);
+      }
+    }
+  }
+
+  have_previous = true;
+  previous_x0 = frame.x0;
+  previous_y0 = frame.y0;
+  previous_size = frame.size;
+}
+
+TrajectoryWriter::TrajectoryWriter() {
+  frames_written.store(0);
+  frames_dropped.store(0);
+  bytes_written.store(0);
+  file = nullptr;
+  frames_since_keyframe = 0;
+  elapsed = 0;
+  queue_begin = 0;
+  queue_size = 0;
+  num_free = 0;
+  closing = false;
+  failed = false;
+}
+
+TrajectoryWriter::~TrajectoryWriter() {
+  close(nullptr);
+}
+
+bool TrajectoryWriter::open(const char *path, int num_stars, int bits, int keyframe_interval, std::string *error) {
+  close(nullptr);
+  file = fopen(path, "wb");
+  if (file == nullptr) {
+    set_message(error, std::string("could not create ") + path + ": " + strerror(errno));
+    return false;
+  }
+  this->path = path;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+  header.version = TRAJECTORY_VERSION;
+  header.bits = std::min(24, std::max(8, bits));
+  header.num_stars = num_stars;
+  header.keyframe_interval = std::max(1, keyframe_interval);
+  if (fwrite(&header, sizeof(header), 1, file) != 1) {
+    set_message(error, std::string("could not write ") + path);
+    fclose(file);
+    file = nullptr;
+    return false;
+  }
+
+  codec.reset(num_stars, header.bits);
+  frames_since_keyframe = 0;
+  elapsed = 0;
+  frames_written.store(0);
+  frames_dropped.store(0);
+  bytes_written.store(sizeof(header));
+  for (int s = 0; s < SLOTS; s++) {
+    slots[s].x.resize(num_stars);
+    slots[s].y.resize(num_stars);
+    free_slots[s] = s;
+  }
+  num_free = SLOTS;
+  queue_begin = 0;
+  queue_size = 0;
+  closing = false;
+  failed = false;
+  failure.clear();
+  thread = std::thread(&TrajectoryWriter::writer_loop, this);
+  return true;
+}
+
+bool TrajectoryWriter::is_open() const {
+  return file != nullptr;
+}
+
+bool TrajectoryWriter::record(Galaxy &galaxy, double dt) {
+  elapsed += dt;
+  if (file == nullptr || galaxy.num_stars() != header.num_stars) {
+    frames_dropped++;
+    return false;
+  }
+  int s;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (num_free == 0) {
+      frames_dropped++;
+      return false;
+    }
+    s = free_slots[--num_free];
+  }
+
+  // stars are stored by id, so every star keeps its place from frame to frame
+  Slot &slot = slots[s];
+  slot.step_number = galaxy.step_number;
+  slot.time = elapsed;
+  auto copy_positions = [&](int begin, int end) {
+    for (int id = begin; id < end; id++) {
+      const Point &p = galaxy.stars[galaxy.star_slots[id]];
+      slot.x[id] = p.x;
+      slot.y[id] = p.y;
+    }
+  };
+  galaxy.scheduler->parallel_for(0, galaxy.num_stars(), 16384, copy_positions);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queue[(queue_begin + queue_size) % SLOTS] = s;
+    queue_size++;
+  }
+  work.notify_one();
+  return true;
+}
+
+bool TrajectoryWriter::close(std::string *error) {
+  if (file == nullptr) {
+    return true;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closing = true;
+  }
+  work.notify_one();
+  thread.join();
+  bool ok = !failed;
+  if (fclose(file) != 0 && ok) {
+    failure = std::string("could not write ") + path;
+    ok = false;
+  }
+  file = nullptr;
+  if (!ok) {
+    set_message(error, failure);
+  }
+  return ok;
+}
+
+void TrajectoryWriter::writer_loop() {
+  while (true) {
+    int s;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (queue_size == 0 && !closing) {
+        work.wait(lock);
+      }
+      if (queue_size == 0) {
+        return;
+      }
+      s = queue[queue_begin];
+      queue_begin = (queue_begin + 1) % SLOTS;
+      queue_size--;
+    }
+
+    if (!failed && !write_frame(slots[s])) {
+      failed = true;
+      failure = std::string("could not write ") + path + ": " + strerror(errno);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      free_slots[num_free++] = s;
+    }
+  }
+}
+
+bool TrajectoryWriter::write_frame(const Slot &slot) {
+  int n = (int)header.num_stars;
+  double min_x = INFINITY;
+  double min_y = INFINITY;
+  double max_x = -INFINITY;
+  double max_y = -INFINITY;
+  for (int i = 0; i < n; i++) {
+    min_x = std::min(min_x, slot.x[i]);
+    min_y = std::min(min_y, slot.y[i]);
+    max_x = std::max(max_x, slot.x[i]);
+    max_y = std::max(max_y, slot.y[i]);
+  }
+
+  TrajectoryFrameHeader frame;
+  memset(&frame, 0, sizeof(frame));
+  frame.magic = TRAJECTORY_FRAME_MAGIC;
+  frame.keyframe = frames_since_keyframe % header.keyframe_interval == 0;
+  frame.step_number = slot.step_number;
+  frame.time = slot.time;
+  if (n > 0 && min_x <= max_x) {
+    // the same square the tree would use
+    double half = std::max(max_x - min_x, max_y - min_y)/2;
+    half = half*(1 + 1e-9) + 1e-9;
+    frame.x0 = (min_x + max_x)/2 - half;
+    frame.y0 = (min_y + max_y)/2 - half;
+    frame.size = 2*half;
+  }
+  else {
+    frame.size = 1;
+  }
+
+  payload.clear();
+  codec.encode(slot.x.data(), slot.y.data(), frame, payload);
+  frame.payload_size = payload.size();
+  if (fwrite(&frame, sizeof(frame), 1, file) != 1 || fwrite(payload.data(), 1, payload.size(), file) != payload.size()) {
+    return false;
+  }
+  frames_since_keyframe++;
+  frames_written++;
+  bytes_written += sizeof(frame) + payload.size();
+  return true;
+}
+
+TrajectoryReader::TrajectoryReader() {
+  memset(&header, 0, sizeof(header));
+  mapping = nullptr;
+  mapping_size = 0;
+  last_decoded = -1;
+}
+
+TrajectoryReader::~TrajectoryReader() {
+  close();
+}
+
+bool TrajectoryReader::open(const char *path, std::string *error) {
+  close();
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    set_message(error, std::string("could not open ") + path + ": " + strerror(errno));
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(TrajectoryHeader)) {
+    ::close(fd);
+    set_message(error, std::string(path) + " is too short to be a trajectory");
+    return false;
+  }
+  void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    set_message(error, std::string("could not map ") + path + ": " + strerror(errno));
+    return false;
+  }
+  mapping = data;
+  mapping_size = info.st_size;
+  memcpy(&header, mapping, sizeof(header));
+  if (memcmp(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic)) != 0 || header.version != TRAJECTORY_VERSION
+      || header.bits < 8 || header.bits > 24 || header.num_stars < 0 || header.num_stars > INT32_MAX) {
+    set_message(error, std::string(path) + " is not a supported trajectory");
+    close();
+    return false;
+  }
+
+  int num_blocks = (int)((header.num_stars + TRAJECTORY_BLOCK - 1)/TRAJECTORY_BLOCK);
+  uint64_t offset = sizeof(TrajectoryHeader);
+  while (offset + sizeof(TrajectoryFrameHeader) <= mapping_size) {
+    const TrajectoryFrameHeader *frame = (const TrajectoryFrameHeader *)((const char *)mapping + offset);
+    uint64_t end = offset + sizeof(TrajectoryFrameHeader) + frame->payload_size;
+    if (frame->magic != TRAJECTORY_FRAME_MAGIC || frame->payload_size < (uint64_t)2*num_blocks + 8
+        || frame->payload_size % 8 != 0 || end > mapping_size) {
+      break;
+    }
+    // a delta frame is only usable behind a keyframe
+    if (frame->keyframe || !keyframes.empty()) {
+      if (frame->keyframe) {
+        keyframes.push_back((int)frame_offsets.size());
+      }
+      frame_offsets.push_back(offset);
+    }
+    offset = end;
+  }
+  codec.reset((int)header.num_stars, header.bits);
+  last_decoded = -1;
+  return true;
+}
+
+void TrajectoryReader::close() {
+  if (mapping != nullptr) {
+    munmap(mapping, mapping_size);
+  }
+  mapping = nullptr;
+  mapping_size = 0;
+  frame_offsets.clear();
+  keyframes.clear();
+  last_decoded = -1;
+}
+
+int TrajectoryReader::num_stars() const {
+  return (int)header.num_stars;
+}
+
+int TrajectoryReader::num_frames() const {
+  return (int)frame_offsets.size();
+}
+
+const TrajectoryFrameHeader &TrajectoryReader::frame(int index) const {
+  return *(const TrajectoryFrameHeader *)((const char *)mapping + frame_offsets[index]);
+}
+
+int TrajectoryReader::keyframe_before(int index) const {
+  std::vector<int>::const_iterator it = std::upper_bound(keyframes.begin(), keyframes.end(), index);
+  return it == keyframes.begin() ? 0 : *(it - 1);
+}
+
+void TrajectoryReader::read_frame(int index, double *x, double *y) {
+  int start = (last_decoded >= 0 && index == last_decoded + 1) ? index : keyframe_before(index);
+  for (int f = start; f <= index; f++) {
+    const TrajectoryFrameHeader &frame_header = frame(f);
+    codec.decode((const uint8_t *)&frame_header + sizeof(TrajectoryFrameHeader), frame_header, x, y);
+  }
+  last_decoded = index;
+}
@@ -0,0 +1,166 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Galaxy.hpp"
+
+// Trajectory file layout, version 2: a TrajectoryHeader, then one record per
+// frame, each a TrajectoryFrameHeader followed by its payload.
+//
+// Positions are quantized to `bits` per axis within the frame's bounding
+// square and stored in star id order. Each frame codes the difference to a
+// prediction: zero for keyframes, otherwise the previous frame's positions
+// re-quantized into this frame's square. Differences are zigzag coded and
+// bit-packed in blocks of TRAJECTORY_BLOCK stars, each block with the width
+// its largest value needs; the payload starts with those widths (x blocks,
+// then y blocks) and ends with at least 8 bytes of padding, rounding it up to
+// a multiple of 8 so every frame header stays aligned.
+const char TRAJECTORY_MAGIC[8] = {'S', 'T', 'A', 'R', 'T', 'R', 'A', 'J'};
+const uint32_t TRAJECTORY_VERSION = 2;
+const uint32_t TRAJECTORY_FRAME_MAGIC = 0x4d415246; // "FRAM"
+const int TRAJECTORY_BLOCK = 128;
+
+struct TrajectoryHeader{
+  char magic[8];
+  uint32_t version;
+  uint32_t bits;              // per coordinate, 8 to 24
+  int64_t num_stars;
+  int32_t keyframe_interval;  // frames
+  uint32_t unused;
+};
+
+struct TrajectoryFrameHeader{
+  uint32_t magic;
+  uint32_t keyframe;
+  int64_t step_number;
+  double time; // simulated time since the recording started
+  double x0;   // bounding square of the frame
+  double y0;
+  double size;
+  uint64_t payload_size;
+};
+
+// Quantizes and predicts frames; the writer and the reader each keep one so
+// both sides make exactly the same predictions.
+class TrajectoryCodec{
+
+public:
+  void reset(int num_stars, int bits);
+  // appends the frame's payload to `out`
+  void encode(const double *x, const double *y, const TrajectoryFrameHeader &frame, std::vector<uint8_t> &out);
+  void decode(const uint8_t *payload, const TrajectoryFrameHeader &frame, double *x, double *y);
+
+private:
+  int num_stars;
+  int bits;
+  bool have_previous;
+  double previous_x0;
+  double previous_y0;
+  double previous_size;
+  std::vector<uint32_t> quantized_x; // previous frame
+  std::vector<uint32_t> quantized_y;
+  std::vector<uint32_t> predicted;
+  std::vector<uint64_t> residuals;
+
+  void predict(const std::vector<uint32_t> &previous, double previous_origin, double origin, const TrajectoryFrameHeader &frame);
+};
+
+// Records frames on a background thread. record() only copies the positions
+// into a free staging slot; quantizing, packing and writing happen on the
+// writer thread, and a frame is dropped rather than waited for when every
+// slot is still busy.
+class TrajectoryWriter{
+
+public:
+  static const int SLOTS = 3;
+
+  std::atomic<long> frames_written;
+  std::atomic<long> frames_dropped;
+  std::atomic<long> bytes_written;
+
+public:
+  TrajectoryWriter();
+  ~TrajectoryWriter();
+  bool open(const char *path, int num_stars, int bits, int keyframe_interval, std::string *error);
+  bool is_open() const;
+  // call after every step with the step's dt, false if the frame was dropped
+  bool record(Galaxy &galaxy, double dt);
+  // writes the frames still queued and closes the file; false if anything failed
+  bool close(std::string *error);
+
+private:
+  struct Slot{
+    long step_number;
+    double time;
+    std::vector<double> x;
+    std::vector<double> y;
+  };
+
+  FILE *file;
+  std::string path;
+  TrajectoryHeader header;
+  TrajectoryCodec codec;
+  std::vector<uint8_t> payload;
+  long frames_since_keyframe;
+  double elapsed; // simulated time, dropped frames included
+
+  Slot slots[SLOTS];
+  int queue[SLOTS]; // slots waiting to be written, oldest first
+  int queue_begin;
+  int queue_size;
+  int free_slots[SLOTS];
+  int num_free;
+  bool closing;
+  bool failed;
+  std::string failure;
+  std::mutex mutex;
+  std::condition_variable work;
+  std::thread thread;
+
+  void writer_loop();
+  bool write_frame(const Slot &slot);
+
+  TrajectoryWriter(const TrajectoryWriter &);
+  TrajectoryWriter &operator=(const TrajectoryWriter &);
+};
+
+// Reads a trajectory through a read-only mapping. Frames are found by
+// walking the frame headers once on open; a file cut short by a crash
+// simply ends at its last complete frame.
+class TrajectoryReader{
+
+public:
+  TrajectoryHeader header;
+
+public:
+  TrajectoryReader();
+  ~TrajectoryReader();
+  bool open(const char *path, std::string *error);
+  void close();
+  int num_stars() const;
+  int num_frames() const;
+  const TrajectoryFrameHeader &frame(int index) const;
+  // the keyframe a seek to `index` decodes from
+  int keyframe_before(int index) const;
+  // positions of a frame in star id order; following frames are decoded
+  // from the previous one, anything else from the nearest keyframe before it
+  void read_frame(int index, double *x, double *y);
+
+private:
+  void *mapping;
+  size_t mapping_size;
+  std::vector<uint64_t> frame_offsets;
+  std::vector<int> keyframes;
+  TrajectoryCodec codec;
+  int last_decoded;
+
+  TrajectoryReader(const TrajectoryReader &);
+  TrajectoryReader &operator=(const TrajectoryReader &);
+};
+#endif
@@ -1,4 +1,5 @@
 #include <cmath>
+#include "helper.h"
 double distance(double x0, double y0, double x1, double y1) {
   return sqrt(pow(x1-x0, 2) + pow(y1-y0, 2));
 }
@@ -14,4 +15,50 @@ double convert_ranges(double oldValue, double oldMin, double oldMax, double newM
       newValue = (((oldValue - oldMin) * newRange) / oldRange) + newMin;
   }
   return newValue;
-}
\ No newline at end of file
+}
+
+// spreads the low 32 bits of v so there is a zero bit between each of them
+static uint64_t spread_bits(uint64_t v) {
+  v &= 0xffffffffULL;
+  v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+  v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+  v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  v = (v | (v << 2)) & 0x3333333333333333ULL;
+  v = (v | (v << 1)) & 0x5555555555555555ULL;
+  return v;
+}
+
+// Z-order key of (x, y) inside the square box at (x0, y0). Each pair of bits
+// selects a quadrant in the same order as the tree: y picks top/bottom, x left/right.
+uint64_t morton_key(double x, double y, double x0, double y0, double size) {
+  const double cells = 4294967296.0; // 2^32 cells per axis
+  double fx = (x - x0)/size*cells;
+  double fy = (y - y0)/size*cells;
+  uint64_t ix = fx <= 0 ? 0 : (fx >= cells-1 ? (uint64_t)(cells-1) : (uint64_t)fx);
+  uint64_t iy = fy <= 0 ? 0 : (fy >= cells-1 ? (uint64_t)(cells-1) : (uint64_t)fy);
+  return (spread_bits(iy) << 1) | spread_bits(ix);
+}
+
+// spreads the low 21 bits of v so there are two zero bits between each of them
+static uint64_t spread_bits_3(uint64_t v) {
+  v &= 0x1fffffULL;
+  v = (v | (v << 32)) & 0x001f00000000ffffULL;
+  v = (v | (v << 16)) & 0x001f0000ff0000ffULL;
+  v = (v | (v << 8)) & 0x100f00f00f00f00fULL;
+  v = (v | (v << 4)) & 0x10c30c30c30c30c3ULL;
+  v = (v | (v << 2)) & 0x1249249249249249ULL;
+  return v;
+}
+
+// Z-order key of (x, y, z) inside the cube at (x0, y0, z0), 21 bits per axis.
+// Each triple of bits selects an octant: z picks the upper bit, then y, then x.
+uint64_t morton_key(double x, double y, double z, double x0, double y0, double z0, double size) {
+  const double cells = 2097152.0; // 2^21 cells per axis
+  double f[3] = {(x - x0)/size*cells, (y - y0)/size*cells, (z - z0)/size*cells};
+  uint64_t key = 0;
+  for (int axis = 0; axis < 3; axis++) {
+    uint64_t i = f[axis] <= 0 ? 0 : (f[axis] >= cells-1 ? (uint64_t)(cells-1) : (uint64_t)f[axis]);
+    key |= spread_bits_3(i) << axis;
+  }
+  return key;
+}
@@ -1,5 +1,8 @@
 #ifndef HELPER_H
 #define HELPER_H
+#include <stdint.h>
 double distance(double x0, double y0, double x1, double y1);
 double convert_ranges(double oldValue, double oldMin, double oldMax, double newMin, double newMax);
+uint64_t morton_key(double x, double y, double x0, double y0, double size);
+uint64_t morton_key(double x, double y, double z, double x0, double y0, double z0, double size);
 #endif
\ No newline at end of file
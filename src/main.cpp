@@ -6,18 +6,121 @@
 #include "implot.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <random>
 #include <cmath>
-
-#include "QuadTree.hpp"
+#include <thread>
+#include <algorithm>
+
+#include "Galaxy.hpp"
+#include "AllocationTracker.hpp"
+#include "Autotune.hpp"
+#include "Headless.hpp"
+#include "InitialConditions.hpp"
+#include "Scenario.hpp"
+#include "Snapshot.hpp"
+#include "Timeline.hpp"
+#include "Trajectory.hpp"
+#include "Playback.hpp"
+#include "RenderBuffer.hpp"
+#include "Tracer.hpp"
 #include "helper.h"
 
 // Determine galaxy size and shape
 const int NUM_STARS = 5000;
 const int RADIUS = 100;
 
+// stops recording and writes the Chrome trace, reporting the outcome in status
+static void save_trace(const char *path, char *status, int status_size) {
+  Tracer::stop();
+  long num_events = Tracer::write(path);
+  if (num_events < 0) {
+    snprintf(status, status_size, "Could not write %s", path);
+  }
+  else {
+    snprintf(status, status_size, "Saved %ld events to %s", num_events, path);
+  }
+  printf("%s\n", status);
+}
+
 int main( int argc, char* argv[] )
 {
+    static char trace_file[256] = "starswift_trace.json";
+    static char trace_status[512] = "";
+    // a scenario sets up the window's galaxy like it does a headless run's;
+    // without one the GUI starts from its own defaults
+    Scenario scenario;
+    scenario.num_stars = NUM_STARS;
+    scenario.conditions.radius = RADIUS;
+    scenario.dt = 0;
+    bool have_scenario = false;
+    for (int i = 1; i + 1 < argc; i++) {
+      if (strcmp(argv[i], "--scenario") == 0) {
+        std::string error;
+        if (!scenario.load(argv[i + 1], &error)) {
+          fprintf(stderr, "%s\n", error.c_str());
+          return 1;
+        }
+        have_scenario = true;
+      }
+    }
+    TunedSettings tuned_settings;
+    bool have_tuning = false;
+    for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--untuned") == 0) {
+        scenario.tuned = false;
+      }
+      if (strcmp(argv[i], "--deterministic") == 0) {
+        scenario.deterministic = true;
+      }
+    }
+    // the window's time step follows the frame time unless a run must repeat
+    if (scenario.deterministic && scenario.dt <= 0) {
+      scenario.dt = 1.0/60;
+    }
+    if (scenario.tuned && find_tuned_settings(TUNING_FILE, scenario.num_stars, &tuned_settings)) {
+      scenario.use_tuned_settings(tuned_settings);
+      have_tuning = true;
+    }
+    if (!scenario.trace_path.empty()) {
+      snprintf(trace_file, sizeof(trace_file), "%s", scenario.trace_path.c_str());
+      Tracer::start();
+    }
+    for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+        snprintf(trace_file, sizeof(trace_file), "%s", argv[i + 1]);
+        Tracer::start();
+      }
+    }
+    // the modes that never open a window, each saving the trace it recorded
+    for (int i = 1; i < argc; i++) {
+      int result;
+      if (strcmp(argv[i], "--headless") == 0) {
+        result = run_headless(argc, argv);
+      }
+      else if (strcmp(argv[i], "--check-determinism") == 0) {
+        result = run_check_determinism(argc, argv);
+      }
+      else if (strcmp(argv[i], "--ensemble") == 0) {
+        result = run_ensemble(argc, argv);
+      }
+      else if (strcmp(argv[i], "--autotune") == 0) {
+        result = run_autotune(argc, argv);
+      }
+      else if (strcmp(argv[i], "--check-allocs") == 0) {
+        result = run_check_allocs(argc, argv);
+      }
+      else if (strcmp(argv[i], "--accuracy") == 0) {
+        result = run_accuracy(argc, argv);
+      }
+      else {
+        continue;
+      }
+      if (Tracer::enabled()) {
+        save_trace(trace_file, trace_status, sizeof(trace_status));
+      }
+      return result;
+    }
 
     // Setup SDL
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER) != 0)
@@ -47,13 +150,19 @@ int main( int argc, char* argv[] )
 
     SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
 
-  // setup random number generator
+  // a fresh seed for every reset unless one is fixed
   double width_middle = SCREEN_WIDTH/2;
   double height_middle = SCREEN_HEIGHT/2;
   std::random_device rd;
-  std::mt19937 mt(rd());
-  std::uniform_real_distribution<double> dist_pos_x(width_middle-RADIUS, width_middle+RADIUS);
-  std::uniform_real_distribution<double> dist_vel(-1000.0, 1000.0);
+  InitialConditions conditions = scenario.conditions;
+  conditions.center_x = width_middle;
+  conditions.center_y = height_middle;
+  conditions.center_z = height_middle;
+  bool fixed_seed = have_scenario; // a scenario's galaxy comes back the same
+  uint64_t seed = scenario.conditions.seed;
+  conditions.seed = fixed_seed ? seed : rd();
+  int reset_stars = scenario.num_stars;
+  float velocity_scale = (float)scenario.conditions.velocity_scale;
 
     // Setup Dear ImGui context
     IMGUI_CHECKVERSION();
@@ -71,11 +180,42 @@ int main( int argc, char* argv[] )
     ImGui_ImplSDLRenderer2_Init(renderer);
 
     // State Variables
-    ImVec4 galaxy_color = ImVec4(0.0f, 0.40f, 1.0f, 1.00f);
-    float gravity_strength = 200.f; // also the point mass
-    float max_speed = 100.0f;
-    float theta = 1.7f;
-    int soft_power = 2;
+    ImVec4 galaxy_color = ImVec4(scenario.color[0], scenario.color[1], scenario.color[2], 1.00f);
+    Galaxy galaxy(scenario.num_stars, SCREEN_WIDTH, SCREEN_HEIGHT); // gravity strength is also the point mass
+    scenario.apply(galaxy);
+    int num_workers = scenario.threads > 0 ? scenario.threads : std::max(1u, std::thread::hardware_concurrency());
+    TaskScheduler scheduler(num_workers);
+    galaxy.scheduler = &scheduler;
+    std::vector<WorkerStats> worker_stats;
+    Profiler profiler;
+    galaxy.profiler = &profiler;
+    // the 3D galaxy lives in a cube as deep as the window is high and takes
+    // its settings from the 2D galaxy's sliders
+    bool three_d = scenario.dimensions == 3;
+    Galaxy3D space(0, SCREEN_WIDTH, SCREEN_HEIGHT, SCREEN_HEIGHT);
+    space.scheduler = &scheduler;
+    space.profiler = &profiler;
+    // looking at the cube's center from where its middle plane shows at the
+    // scale of the 2D view
+    Camera default_camera;
+    default_camera.target[0] = width_middle;
+    default_camera.target[1] = height_middle;
+    default_camera.target[2] = height_middle;
+    default_camera.distance = SCREEN_HEIGHT/2/std::tan(default_camera.field_of_view/2);
+    default_camera.screen_x = width_middle;
+    default_camera.screen_y = height_middle;
+    Camera camera = default_camera;
+    auto reset_space = [&]() {
+      space.resize(reset_stars);
+      space.take_settings(galaxy);
+      generate_initial_conditions(space, conditions);
+    };
+    // every star lands in one buffer that is uploaded as a single texture
+    RenderBuffer render_buffer;
+    render_buffer.resize(ACTUAL_WIDTH, SCREEN_HEIGHT);
+    SDL_Texture *star_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, ACTUAL_WIDTH, SCREEN_HEIGHT);
+    AllocationCounts frame_start_allocations = allocation_counts();
+    AllocationCounts last_frame_allocations = {0, 0, 0};
     bool show_velocity_vectors = false;
     bool show_gravity_vectors = false;
     double total_kinetic_energy = 0;
@@ -88,7 +228,7 @@ int main( int argc, char* argv[] )
         xs1[i] = i * 1.0f;
     }
     enum ColorMode { Color_Solid, Color_Radial, Color_Velocity, Color_COUNT };
-    static int color_mode = 0;
+    static int color_mode = scenario.color_mode;
     const char* color_mode_names[Color_COUNT] = {"Radial", "Solid", "Velocity"};
     bool update = true;
 
@@ -96,19 +236,53 @@ int main( int argc, char* argv[] )
     bool quit = false; 
     double oldTime = SDL_GetTicks();
     
-    Point* stars[NUM_STARS]; //need to free memory when resized and points move to child quadrants
-    for(int i=0; i < NUM_STARS; i++) {
-      double x = dist_pos_x(mt);
-      // Determines shape of the galaxy, currently a perfect circle
-      double y_variance = sqrt(RADIUS*RADIUS - (x-width_middle)*(x-width_middle));
-      std::uniform_real_distribution<double> dist_pos_y(-y_variance+height_middle, y_variance+height_middle);
-      double y = dist_pos_y(mt);
-      double central_x = x-SCREEN_WIDTH/2.0;
-      double central_y = y-SCREEN_HEIGHT/2.0;
-      double vx = (RADIUS-x)/(abs(RADIUS-x))/sqrt(x*x + y*y)*10;
-      double vy = (RADIUS-y)/(abs(RADIUS-y))/sqrt(x*x + y*y)*10;
-      stars[i] = new Point(x, y, vy, -vx, 0, 0);
-  }
+    static std::string scenario_status;
+    if (!scenario.snapshot_path.empty() && !load_snapshot(galaxy, scenario.snapshot_path.c_str(), &scenario_status)) {
+      scenario.snapshot_path.clear();
+    }
+    if (scenario.snapshot_path.empty()) {
+      generate_initial_conditions(galaxy, conditions);
+    }
+    if (three_d) {
+      reset_space();
+    }
+    // the scenario's parameter changes play out as the galaxy steps
+    Timeline script = scenario.timeline;
+    // Everything since the galaxy was last reset or loaded, saved as a
+    // scenario that replays the session's slider changes headless.
+    Scenario session;
+    long session_start = 0;
+    double session_time = 0;
+    auto begin_session = [&](const std::string &snapshot_path) {
+      session = Scenario();
+      session.num_stars = galaxy.num_stars();
+      session.conditions = conditions;
+      session.snapshot_path = snapshot_path;
+      session.capture(galaxy);
+      session.timeline.record(galaxy);
+      session_start = galaxy.step_number;
+      session_time = 0;
+    };
+    begin_session(scenario.snapshot_path);
+    TrajectoryWriter trajectory;
+    static char snapshot_file[256] = "galaxy.snap";
+    static std::string snapshot_status;
+    if (!scenario.save_path.empty()) {
+      snprintf(snapshot_file, sizeof(snapshot_file), "%s", scenario.save_path.c_str());
+    }
+    static char trajectory_file[256] = "galaxy.traj";
+    static std::string trajectory_status;
+    if (!scenario.record_path.empty()) {
+      std::string error;
+      snprintf(trajectory_file, sizeof(trajectory_file), "%s", scenario.record_path.c_str());
+      trajectory_status = trajectory.open(trajectory_file, galaxy.num_stars(), scenario.record_bits, scenario.keyframe_interval, &error)
+                          ? "Recording..." : error;
+    }
+    TrajectoryPlayer player;
+    double playback_position = 0; // in frames
+    bool playback_paused = false;
+    float playback_speed = 1.0f;
+    static std::string playback_status;
 
     while(!quit){
       while(SDL_PollEvent( &e ) != 0){ 
@@ -116,17 +290,22 @@ int main( int argc, char* argv[] )
         if( e.type == SDL_QUIT ){
           quit = true; 
         }
+        // dragging and the wheel move the 3D camera unless ImGui has the mouse
+        if (three_d && !io.WantCaptureMouse) {
+          if (e.type == SDL_MOUSEMOTION && (e.motion.state & SDL_BUTTON_LMASK)) {
+            camera.rotate(e.motion.xrel, e.motion.yrel);
+          }
+          if (e.type == SDL_MOUSEWHEEL) {
+            camera.zoom(e.wheel.y);
+          }
+        }
       } 
-      // rebuild quadtree
-      QuadTree* root = new QuadTree(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, nullptr, gravity_strength, max_speed, theta, soft_power);
-      for (int i=0; i < NUM_STARS; i++) {
-        root->insert(stars[i]);
-      }
-
       // Start the Dear ImGui frame
+      profiler.start(PHASE_IMGUI);
       ImGui_ImplSDLRenderer2_NewFrame();
       ImGui_ImplSDL2_NewFrame();
       ImGui::NewFrame();
+      profiler.stop(PHASE_IMGUI);
 
       double newTime = SDL_GetTicks();
       double deltaTime = (newTime - oldTime) / 1000.0f;
@@ -134,22 +313,81 @@ int main( int argc, char* argv[] )
       SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
       SDL_RenderClear(renderer);
 
-      if(update) {
-        root->update_galaxy(root, deltaTime);
+      // while a recording plays back the simulation stands still
+      TrajectoryPlayer::Frame *playback_frame = nullptr;
+      if (player.is_open()) {
+        int last_frame = std::max(0, player.num_frames() - 1);
+        if (!playback_paused && last_frame > 0) {
+          double frame_rate = last_frame/std::max(player.duration(), 1e-9);
+          playback_position = std::min(playback_position + deltaTime*playback_speed*frame_rate, (double)last_frame);
+        }
+        playback_frame = player.show((int)playback_position);
+      }
+      // the timeline and the session follow the 2D galaxy only
+      else if (three_d) {
+        space.take_settings(galaxy);
+        if (update) {
+          space.step(scenario.dt > 0 ? scenario.dt : deltaTime);
+        }
+      }
+      // rebuild quadtree around wherever the stars currently are
+      else if(update) {
+        // a scenario may fix the time step, otherwise it follows the frame time
+        double step_dt = scenario.dt > 0 ? scenario.dt : deltaTime;
+        script.apply(galaxy);
+        galaxy.step(step_dt);
+        session_time += step_dt;
+        if (trajectory.is_open()) {
+          trajectory.record(galaxy, step_dt);
+        }
+      }
+      else {
+        galaxy.build_tree();
       }
 
-      // reset state variables
-      total_gravitational_potential_energy = 0;
-      total_kinetic_energy = 0;
-      for (int i=0; i < NUM_STARS; i++) {
-        Point *p = stars[i];
-        total_kinetic_energy += gravity_strength*distance(p->x, p->y, p->x+p->vx, p->y+p->vy); // 1/2mv^2
-        total_gravitational_potential_energy -= gravity_strength*distance(p->x, p->y, p->x+p->ax, p->y+p->ay);
-
-
-        p->update_star_color(root->center_of_mass_x, root->center_of_mass_y, RADIUS, max_speed, galaxy_color.x, galaxy_color.y, galaxy_color.z, color_mode);
-        SDL_SetRenderDrawColor(renderer, p->r, p->g, p->b, 255);
-        SDL_RenderDrawPoint(renderer, p->x, p->y);
+      const Point *shown_stars = galaxy.stars.data();
+      int num_shown = galaxy.num_stars();
+      if (player.is_open()) {
+        shown_stars = playback_frame != nullptr ? playback_frame->stars.data() : nullptr;
+        num_shown = playback_frame != nullptr ? (int)playback_frame->stars.size() : 0;
+        if (playback_frame != nullptr) {
+          ScopedTimer timer(&profiler, PHASE_COLORING);
+          player.update_colors(*playback_frame, RADIUS, galaxy.max_speed, galaxy_color.x, galaxy_color.y, galaxy_color.z, color_mode, scheduler);
+        }
+      }
+      else if (three_d) {
+        space.compute_energy(&total_kinetic_energy, &total_gravitational_potential_energy);
+      }
+      else {
+        galaxy.compute_energy(&total_kinetic_energy, &total_gravitational_potential_energy);
+        galaxy.update_colors(RADIUS, galaxy_color.x, galaxy_color.y, galaxy_color.z, color_mode);
+      }
+      scheduler.take_stats(worker_stats);
+
+      profiler.start(PHASE_DRAWING);
+      bool show_space = three_d && !player.is_open();
+      if (show_space) {
+        // 3D stars are projected and coloured in the same pass
+        StarColoring coloring;
+        coloring.mode = color_mode;
+        for (int axis = 0; axis < 3; axis++) {
+          coloring.center[axis] = space.center_of_mass[axis];
+        }
+        coloring.max_distance = RADIUS;
+        coloring.max_speed = space.max_speed;
+        coloring.color[0] = galaxy_color.x;
+        coloring.color[1] = galaxy_color.y;
+        coloring.color[2] = galaxy_color.z;
+        render_buffer.draw(space.stars.data(), space.num_stars(), camera, coloring, scheduler);
+      }
+      else {
+        render_buffer.draw(shown_stars, num_shown, scheduler);
+      }
+      SDL_UpdateTexture(star_texture, nullptr, render_buffer.pixels.data(), render_buffer.width*sizeof(uint32_t));
+      SDL_RenderCopy(renderer, star_texture, nullptr, nullptr);
+      // vectors are 2D only, and still a line per star
+      for (int i=0; i < num_shown && !show_space; i++) {
+        const Point *p = &shown_stars[i];
         if(show_velocity_vectors) {
           SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
           SDL_RenderDrawLine(renderer, p->x, p->y, p->x + p->vx/5.0, p->y + p->vy/5.0);
@@ -160,36 +398,257 @@ int main( int argc, char* argv[] )
                        p->x, p->y, p->x + p->ax, p->y + p->ay);
         }
       }
-      delete root;
-      root = nullptr;
-
+      profiler.stop(PHASE_DRAWING);
       static int counter = 0;
 
       ImGuiWindowFlags window_flags = 0;
       window_flags |= ImGuiWindowFlags_NoBackground;
       bool p_open = true;
 
+      profiler.start(PHASE_IMGUI);
       ImGui::Begin("Galaxy Settings", &p_open, window_flags);
       ImGui::SeparatorText("General");
       if(ImGui::Button("Pause/Start", ImVec2(ImGui::GetWindowSize().x*1.0f, 0.0f))){
         update = !update;
         }
       if (ImGui::Button("Reset Galaxy", ImVec2(ImGui::GetWindowSize().x*1.0f, 0.0f))) {
-        for(int i=0; i < NUM_STARS; i++) {
-          double x = dist_pos_x(mt);
-          double y_variance = sqrt(RADIUS*RADIUS - (x-width_middle)*(x-width_middle));
-          std::uniform_real_distribution<double> dist_pos_y(-y_variance+height_middle, y_variance+height_middle);
-          double y = dist_pos_y(mt);
-          double vx = (RADIUS-x)/(abs(RADIUS-x))/sqrt(x*x + y*y)*10;
-          double vy = (RADIUS-y)/(abs(RADIUS-y))/sqrt(x*x + y*y)*10;
-          *stars[i] = Point(x, y, vy, -vx, 0, 0);
-    }
-
+        conditions.seed = fixed_seed ? seed : rd();
+        if (three_d) {
+          reset_space();
+        }
+        else {
+          // a recording is for one star count, end it before the count changes
+          if (trajectory.is_open()) {
+            std::string error;
+            trajectory_status = trajectory.close(&error) ? std::string("Saved ") + trajectory_file : error;
+          }
+          galaxy.resize(reset_stars);
+          generate_initial_conditions(galaxy, conditions);
+          script = Timeline();
+          begin_session("");
+        }
+      }
+      // a fresh 3D galaxy every time it is switched on; playback is 2D
+      ImGui::BeginDisabled(player.is_open());
+      if (ImGui::Checkbox("3D", &three_d) && three_d) {
+        reset_space();
       }
-      ImGui::SliderFloat("Gravitational Strength", &gravity_strength, 0.0f, 1000.f);
-      ImGui::SliderFloat("Max Star Velocity", &max_speed, 0.0f, 1000.f);
-      ImGui::SliderFloat("Theta Threshold", &theta, 0.0f, 5.0f);
-      ImGui::SliderInt("Collision Softening", &soft_power, -5, 5);
+      ImGui::EndDisabled();
+      if (three_d) {
+        ImGui::SameLine();
+        if (ImGui::Button("Reset Camera")) {
+          camera = default_camera;
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("drag to rotate, wheel to zoom");
+      }
+      ImGui::Combo("Galaxy Model", &conditions.model, galaxy_model_names, MODEL_COUNT);
+      ImGui::SliderInt("Stars", &reset_stars, 1000, 1000000, "%d", ImGuiSliderFlags_Logarithmic);
+      if (ImGui::SliderFloat("Velocity Scale", &velocity_scale, 0.0f, 2.0f)) {
+        conditions.velocity_scale = velocity_scale;
+      }
+      if (conditions.model == MODEL_COLLISION) {
+        ImGui::SliderInt("Galaxies", &conditions.num_galaxies, 2, 6);
+      }
+      ImGui::Checkbox("Fixed Seed", &fixed_seed);
+      if (fixed_seed) {
+        ImGui::SameLine();
+        ImGui::InputScalar("Seed", ImGuiDataType_U64, &seed);
+      }
+      static char scenario_file[256] = "scenarios/collision.ini";
+      ImGui::InputText("Scenario File", scenario_file, sizeof(scenario_file));
+      if (ImGui::Button("Load Scenario")) {
+        // settings the file leaves out go back to the GUI's defaults
+        Scenario loaded;
+        loaded.num_stars = NUM_STARS;
+        loaded.conditions.radius = RADIUS;
+        loaded.dt = 0;
+        std::string error;
+        if (loaded.load(scenario_file, &error)) {
+          if (loaded.deterministic && loaded.dt <= 0) {
+            loaded.dt = 1.0/60;
+          }
+          have_tuning = loaded.tuned && find_tuned_settings(TUNING_FILE, loaded.num_stars, &tuned_settings);
+          if (have_tuning) {
+            loaded.use_tuned_settings(tuned_settings);
+          }
+          scenario = loaded;
+          scenario.apply(galaxy);
+          conditions = scenario.conditions;
+          conditions.center_x = width_middle;
+          conditions.center_y = height_middle;
+          conditions.center_z = height_middle;
+          fixed_seed = true;
+          seed = scenario.conditions.seed;
+          conditions.seed = seed;
+          reset_stars = scenario.num_stars;
+          velocity_scale = (float)scenario.conditions.velocity_scale;
+          galaxy_color = ImVec4(scenario.color[0], scenario.color[1], scenario.color[2], 1.00f);
+          color_mode = scenario.color_mode;
+          if (scenario.threads > 0) {
+            num_workers = scenario.threads;
+            scheduler.set_num_workers(num_workers);
+          }
+          if (trajectory.is_open()) {
+            trajectory_status = trajectory.close(&error) ? std::string("Saved ") + trajectory_file : error;
+          }
+          scenario_status = std::string("Loaded ") + scenario_file;
+          if (!scenario.snapshot_path.empty() && !load_snapshot(galaxy, scenario.snapshot_path.c_str(), &scenario_status)) {
+            scenario.snapshot_path.clear();
+          }
+          if (scenario.snapshot_path.empty()) {
+            galaxy.resize(reset_stars);
+            generate_initial_conditions(galaxy, conditions);
+          }
+          script = scenario.timeline;
+          begin_session(scenario.snapshot_path);
+          three_d = scenario.dimensions == 3;
+          if (three_d) {
+            reset_space();
+          }
+        }
+        else {
+          scenario_status = error;
+        }
+      }
+      ImGui::TextUnformatted(scenario_status.c_str());
+      // snapshots, sessions, recordings and playback hold 2D stars
+      ImGui::BeginDisabled(three_d);
+      ImGui::InputText("Snapshot File", snapshot_file, sizeof(snapshot_file));
+      if (ImGui::Button("Save Snapshot")) {
+        std::string error;
+        snapshot_status = save_snapshot(galaxy, snapshot_file, &error) ? std::string("Saved ") + snapshot_file : error;
+      }
+      ImGui::SameLine();
+      if (ImGui::Button("Load Snapshot")) {
+        std::string error;
+        if (trajectory.is_open()) {
+          trajectory_status = trajectory.close(&error) ? std::string("Saved ") + trajectory_file : error;
+        }
+        if (load_snapshot(galaxy, snapshot_file, &error)) {
+          snapshot_status = std::string("Loaded ") + snapshot_file;
+          script = Timeline();
+          begin_session(snapshot_file);
+        }
+        else {
+          snapshot_status = error;
+        }
+      }
+      ImGui::TextUnformatted(snapshot_status.c_str());
+      static char session_file[256] = "session.ini";
+      static std::string session_status;
+      ImGui::InputText("Session File", session_file, sizeof(session_file));
+      if (ImGui::Button("Save Session")) {
+        // frame times vary, the replay steps by their average
+        long steps = galaxy.step_number - session_start;
+        session.steps = (int)steps;
+        session.dt = scenario.dt > 0 ? scenario.dt : steps > 0 ? session_time/steps : 1.0/60;
+        session.threads = num_workers;
+        session.tuned = false; // replays with this machine's settings, tuned or not
+        session.color[0] = galaxy_color.x;
+        session.color[1] = galaxy_color.y;
+        session.color[2] = galaxy_color.z;
+        session.color_mode = color_mode;
+        std::string error;
+        session_status = session.save(session_file, &error) ? std::string("Saved ") + session_file : error;
+      }
+      ImGui::SameLine();
+      ImGui::Text("%d parameter changes in %ld steps", (int)session.timeline.changes.size(), galaxy.step_number - session_start);
+      ImGui::TextUnformatted(session_status.c_str());
+      ImGui::EndDisabled();
+
+      ImGui::SeparatorText("Recording");
+      static int record_bits = scenario.record_bits;
+      static int keyframe_interval = scenario.keyframe_interval;
+      ImGui::InputText("Trajectory File", trajectory_file, sizeof(trajectory_file));
+      if (!trajectory.is_open()) {
+        ImGui::SliderInt("Bits per Coordinate", &record_bits, 8, 24);
+        ImGui::SliderInt("Keyframe Interval", &keyframe_interval, 1, 600);
+        ImGui::BeginDisabled(three_d);
+        bool start_recording = ImGui::Button("Start Recording", ImVec2(ImGui::GetWindowSize().x*1.0f, 0.0f));
+        ImGui::EndDisabled();
+        if (start_recording) {
+          std::string error;
+          trajectory_status = trajectory.open(trajectory_file, galaxy.num_stars(), record_bits, keyframe_interval, &error)
+                              ? "Recording..." : error;
+        }
+      }
+      else {
+        if (ImGui::Button("Stop Recording", ImVec2(ImGui::GetWindowSize().x*1.0f, 0.0f))) {
+          std::string error;
+          trajectory_status = trajectory.close(&error) ? std::string("Saved ") + trajectory_file : error;
+        }
+      }
+      long recorded_frames = trajectory.frames_written;
+      if (recorded_frames > 0 || trajectory.is_open()) {
+        ImGui::Text("%ld frames (%ld dropped), %.1f MB, %.2f bytes/star/frame", recorded_frames, (long)trajectory.frames_dropped,
+                    trajectory.bytes_written/1048576.0,
+                    recorded_frames > 0 ? (double)trajectory.bytes_written/recorded_frames/std::max(1, galaxy.num_stars()) : 0.0);
+      }
+      ImGui::TextUnformatted(trajectory_status.c_str());
+
+      ImGui::SeparatorText("Playback");
+      if (!player.is_open()) {
+        ImGui::BeginDisabled(three_d);
+        bool play = ImGui::Button("Play Trajectory", ImVec2(ImGui::GetWindowSize().x*1.0f, 0.0f));
+        ImGui::EndDisabled();
+        if (play) {
+          std::string error;
+          playback_position = 0;
+          playback_paused = false;
+          playback_status = player.open(trajectory_file, &error) ? std::string("Playing ") + trajectory_file : error;
+        }
+      }
+      else {
+        if (ImGui::Button(playback_paused ? "Resume" : "Pause")) {
+          playback_paused = !playback_paused;
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Back to Simulation")) {
+          player.close();
+          playback_status.clear();
+        }
+        int frame_slider = (int)playback_position;
+        if (ImGui::SliderInt("Frame", &frame_slider, 0, std::max(0, player.num_frames() - 1))) {
+          playback_position = frame_slider;
+        }
+        ImGui::SliderFloat("Playback Speed", &playback_speed, 0.1f, 16.0f, "%.2fx", ImGuiSliderFlags_Logarithmic);
+        if (playback_frame != nullptr) {
+          ImGui::Text("Step %ld, %.2f s, %d stars", playback_frame->step_number, playback_frame->time, player.num_stars());
+        }
+      }
+      ImGui::TextUnformatted(playback_status.c_str());
+      ImGui::SliderFloat("Gravitational Strength", &galaxy.gravity_strength, 0.0f, 1000.f);
+      ImGui::SliderFloat("Max Star Velocity", &galaxy.max_speed, 0.0f, 1000.f);
+      const char *solvers[SOLVER_COUNT] = {"Barnes-Hut", "Direct Summation"};
+      // 3D is always Barnes-Hut at a fixed theta
+      ImGui::BeginDisabled(three_d);
+      ImGui::Combo("Force Solver", &galaxy.solver, solvers, SOLVER_COUNT);
+      ImGui::EndDisabled();
+      ImGui::SliderFloat("Theta Threshold", &galaxy.theta, 0.0f, 5.0f);
+      const char *theta_modes[THETA_MODE_COUNT] = {"Off", "Step Time", "Force Error"};
+      ThetaController &controller = galaxy.theta_controller;
+      ImGui::BeginDisabled(three_d);
+      ImGui::Combo("Adaptive Theta", &controller.mode, theta_modes, THETA_MODE_COUNT);
+      ImGui::EndDisabled();
+      if (controller.mode != THETA_FIXED) {
+        if (controller.mode == THETA_STEP_TIME) {
+          float target_ms = (float)controller.target_ms;
+          if (ImGui::SliderFloat("Target Step Time", &target_ms, 1.0f, 200.0f, "%.1f ms", ImGuiSliderFlags_Logarithmic)) {
+            controller.target_ms = target_ms;
+          }
+        }
+        else {
+          float target_error = (float)controller.target_error;
+          if (ImGui::SliderFloat("Target Force Error", &target_error, 1e-4f, 0.1f, "%.1e", ImGuiSliderFlags_Logarithmic)) {
+            controller.target_error = target_error;
+          }
+        }
+        ImGui::DragFloatRange2("Theta Bounds", &controller.min_theta, &controller.max_theta, 0.01f, 0.05f, 5.0f, "%.2f");
+        ImGui::Text("Theta %.3f: %.2f ms/step, %.2e force error, %.0f interactions/star",
+                    galaxy.theta, controller.step_ms, controller.force_error, controller.interactions);
+      }
+      ImGui::SliderInt("Collision Softening", &galaxy.soft_power, -5, 5);
       ImGui::ColorEdit3("Galaxy Color", (float*)&galaxy_color); // Edit 3 floats representing a color
       const char* get_color_mode = (color_mode >= 0 && color_mode < Color_COUNT) ? color_mode_names[color_mode] : "Unknown";
       ImGui::SliderInt("Color Modes", &color_mode, 0, Color_COUNT - 1, get_color_mode); // Use ImGuiSliderFlags_NoInp
@@ -197,6 +656,50 @@ int main( int argc, char* argv[] )
       ImGui::SeparatorText("Vector Display");
       ImGui::Checkbox("Show Velocity Vectors", &show_velocity_vectors);
       ImGui::Checkbox("Show Gravity Vectors", &show_gravity_vectors);
+      ImGui::SeparatorText("Performance");
+      ImGui::SliderInt("Morton Reorder Interval", &galaxy.reorder_interval, 0, 100);
+      ImGui::Checkbox("Single Precision Forces", &galaxy.float_forces);
+      ImGui::SliderInt("Leaf Capacity", &galaxy.leaf_capacity, 1, 32);
+      ImGui::Checkbox("Cost-Zone Balancing", &galaxy.cost_zones);
+      if (ImGui::SliderInt("Worker Threads", &num_workers, 1, std::max(1u, std::thread::hardware_concurrency()))) {
+        scheduler.set_num_workers(num_workers);
+      }
+      if (have_tuning) {
+        ImGui::Text("Tuned for %d stars: %d threads, leaf capacity %d, %s forces", tuned_settings.num_stars, tuned_settings.threads,
+                    tuned_settings.leaf_capacity, tuned_settings.float_forces ? "float" : "double");
+      }
+      else {
+        ImGui::TextDisabled("Not tuned for this host, run with --autotune");
+      }
+      if (ImGui::BeginTable("Workers", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_SizingStretchSame)) {
+        ImGui::TableSetupColumn("Worker");
+        ImGui::TableSetupColumn("Busy (ms)");
+        ImGui::TableSetupColumn("Tasks");
+        ImGui::TableSetupColumn("Steals");
+        ImGui::TableHeadersRow();
+        for (size_t i = 0; i < worker_stats.size(); i++) {
+          ImGui::TableNextRow();
+          ImGui::TableNextColumn(); ImGui::Text("%d", (int)i);
+          ImGui::TableNextColumn(); ImGui::Text("%.2f", worker_stats[i].busy_ms);
+          ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)worker_stats[i].tasks);
+          ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)worker_stats[i].steals);
+        }
+        ImGui::EndTable();
+      }
+      ImGui::SeparatorText("Tree Stats");
+      ImGui::Checkbox("Collect Tree Stats", &galaxy.collect_stats);
+      if (galaxy.collect_stats) {
+        const TreeStats &tree_stats = three_d ? space.tree.tree_stats : galaxy.tree.tree_stats;
+        const WalkStats &walk_stats = three_d ? space.tree.walk_stats : galaxy.tree.walk_stats;
+        double walks = std::max(1L, walk_stats.walks);
+        ImGui::Text("Nodes: %d (%d leaves), %.2f MB", tree_stats.num_nodes, tree_stats.num_leaves, tree_stats.memory_bytes/1048576.0);
+        ImGui::Text("Depth: %d max, %.1f mean leaf", tree_stats.max_depth, tree_stats.mean_leaf_depth);
+        ImGui::Text("Leaf Occupancy: %.2f stars (max %d), %.0f%% of child slots used", tree_stats.mean_leaf_stars, tree_stats.max_leaf_stars, 100*tree_stats.child_occupancy);
+        ImGui::Text("Nodes Opened per Star: %.1f", walk_stats.nodes_opened/walks);
+        ImGui::Text("MAC Acceptance: %.1f%% of %.1f cells tested per star",
+                    walk_stats.cells_tested > 0 ? 100.0*walk_stats.cells_accepted/walk_stats.cells_tested : 0.0, walk_stats.cells_tested/walks);
+        ImGui::Text("Interactions per Star: %.1f (%.1f direct)", walk_stats.interactions/walks, walk_stats.direct_stars/walks);
+      }
       ImGui::SeparatorText("Stats");
 
     
@@ -214,34 +717,112 @@ int main( int argc, char* argv[] )
     }
       ////////////
       ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
+
+      ImGui::SeparatorText("Frame Profile");
+      // stack the phases on top of each other, one band per phase
+      static float phase_tops[PHASE_COUNT][Profiler::HISTORY];
+      static float frame_index[Profiler::HISTORY];
+      for (int i = 0; i < Profiler::HISTORY; i++) {
+        frame_index[i] = (float)i;
+        float top = 0;
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+          top += profiler.history[phase][i];
+          phase_tops[phase][i] = top;
+        }
+      }
+      if (ImPlot::BeginPlot("Phase Times", ImVec2(-1, 200))) {
+        ImPlot::SetupAxes("frame", "ms", ImPlotAxisFlags_None, ImPlotAxisFlags_AutoFit);
+        for (int phase = PHASE_COUNT - 1; phase >= 0; phase--) {
+          if (phase == 0) {
+            ImPlot::PlotShaded(Profiler::phase_names[phase], frame_index, phase_tops[phase], Profiler::HISTORY);
+          }
+          else {
+            ImPlot::PlotShaded(Profiler::phase_names[phase], frame_index, phase_tops[phase - 1], phase_tops[phase], Profiler::HISTORY);
+          }
+        }
+        ImPlot::EndPlot();
+      }
+      if (ImGui::BeginTable("Phase Stats", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_SizingStretchSame)) {
+        ImGui::TableSetupColumn("Phase (ms)");
+        ImGui::TableSetupColumn("Min");
+        ImGui::TableSetupColumn("Avg");
+        ImGui::TableSetupColumn("P99");
+        ImGui::TableHeadersRow();
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+          float min, avg, p99;
+          profiler.phase_stats(phase, &min, &avg, &p99);
+          ImGui::TableNextRow();
+          ImGui::TableNextColumn(); ImGui::Text("%s", Profiler::phase_names[phase]);
+          ImGui::TableNextColumn(); ImGui::Text("%.3f", min);
+          ImGui::TableNextColumn(); ImGui::Text("%.3f", avg);
+          ImGui::TableNextColumn(); ImGui::Text("%.3f", p99);
+        }
+        ImGui::EndTable();
+      }
+      if (tracking_allocations()) {
+        ImGui::Text("Heap Allocations: %llu last frame (%.1f KB), %llu frees",
+                    (unsigned long long)last_frame_allocations.allocations, last_frame_allocations.bytes/1024.0,
+                    (unsigned long long)last_frame_allocations.frees);
+      }
+      else {
+        ImGui::TextDisabled("Heap Allocations: build with make profile to count");
+      }
+      ImGui::InputText("Trace File", trace_file, sizeof(trace_file));
+      if (!Tracer::enabled()) {
+        if (ImGui::Button("Start Trace", ImVec2(ImGui::GetWindowSize().x*1.0f, 0.0f))) {
+          Tracer::start();
+          snprintf(trace_status, sizeof(trace_status), "Recording...");
+        }
+      }
+      else if (ImGui::Button("Stop and Save Trace", ImVec2(ImGui::GetWindowSize().x*1.0f, 0.0f))) {
+        save_trace(trace_file, trace_status, sizeof(trace_status));
+      }
+      ImGui::TextUnformatted(trace_status);
       ImGui::End();
+      session.timeline.record(galaxy);
 
     // Rendering
         ImGui::Render();
         SDL_RenderSetScale(renderer, io.DisplayFramebufferScale.x, io.DisplayFramebufferScale.y);
         SDL_SetRenderDrawColor(renderer, (Uint8)(galaxy_color.x * 255), (Uint8)(galaxy_color.y * 255), (Uint8)(galaxy_color.z * 255), (Uint8)(galaxy_color.w * 255));
         ImGui_ImplSDLRenderer2_RenderDrawData(ImGui::GetDrawData());
+      profiler.stop(PHASE_IMGUI);
 
+      profiler.start(PHASE_PRESENT);
       SDL_RenderPresent(renderer);
+      profiler.stop(PHASE_PRESENT);
+      profiler.end_frame();
+      AllocationCounts frame_end_allocations = allocation_counts();
+      last_frame_allocations.allocations = frame_end_allocations.allocations - frame_start_allocations.allocations;
+      last_frame_allocations.frees = frame_end_allocations.frees - frame_start_allocations.frees;
+      last_frame_allocations.bytes = frame_end_allocations.bytes - frame_start_allocations.bytes;
+      frame_start_allocations = frame_end_allocations;
 
       SDL_Delay(1);
       oldTime = newTime;
     }
 
+  if (Tracer::enabled()) {
+    save_trace(trace_file, trace_status, sizeof(trace_status));
+  }
+  if (trajectory.is_open()) {
+    std::string error;
+    if (!trajectory.close(&error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+    }
+  }
+
   // Cleanup
   ImGui_ImplSDLRenderer2_Shutdown();
   ImGui_ImplSDL2_Shutdown();
   ImPlot::DestroyContext();
   ImGui::DestroyContext();
 
+  SDL_DestroyTexture(star_texture);
   SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow( window );
 	SDL_Quit();
 
-  for (int i=0; i < NUM_STARS; i++) {
-    delete stars[i];
-  }
-
 
 	return 0;
 }
\ No newline at end of file